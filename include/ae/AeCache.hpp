@@ -0,0 +1,262 @@
+#ifndef AECACHE__HPP__
+#define AECACHE__HPP__
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "ae/SMTUtils.hpp"
+#include "ufo/Smt/EZ3.hh"
+#include "ufo/ExprBin.hpp"
+
+using namespace std;
+using namespace boost;
+namespace ufo
+{
+
+  /**
+   * On-disk cache of AE-VAL results, addressed by the content of the preprocessed query.
+   * Constants are renamed in the order of their first occurrence, so alpha-equivalent
+   * queries share an entry. Only valid results are stored, together with their Skolem
+   * (in the format of ExprBin): an entry is reused only after one implication check
+   * (S /\ Skolem => T)
+   */
+  class AeResultCache
+  {
+  private:
+
+    enum { version = 2 };
+
+    ExprFactory &efac;
+    string key;      // canonical text of the query and of the output options
+    string path;     // empty if the query can not be cached
+    ExprMap toCanon;
+    ExprMap fromCanon;
+    ExprSet exists;  // canonical existentials
+
+    static unsigned long long hash (const string &str)
+    {
+      // FNV-1a
+      unsigned long long h = 14695981039346656037ULL;
+      for (char c : str)
+      {
+        h ^= (unsigned char) c;
+        h *= 1099511628211ULL;
+      }
+      return h;
+    }
+
+    Expr mkCanonConst (Expr c, int i)
+    {
+      Expr name = mkTerm<string> ("_aeval_cv_" + lexical_cast<string>(i), efac);
+      if (bind::isBoolConst (c)) return bind::boolConst (name);
+      if (bind::isIntConst (c)) return bind::intConst (name);
+      if (bind::isRealConst (c)) return bind::realConst (name);
+      return NULL;
+    }
+
+  public:
+
+    AeResultCache (const char *dir, Expr s, Expr t, ExprSet &t_quantified,
+                   bool compact, bool split, bool tree, bool order, const char *trace) :
+      efac (s->getFactory ())
+    {
+      // -- the samples of a trace select the order of the branches, so they are a part of the key
+      string samples;
+      if (trace != NULL)
+      {
+        ifstream in (trace, ios::binary);
+        if (!in) return;
+        samples.assign (istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+      }
+
+      ExprVector vars;
+      filter (mk<AND>(s, t), bind::IsConst (), back_inserter (vars));
+      for (auto & a : t_quantified)
+        if (find (vars.begin(), vars.end(), a) == vars.end()) vars.push_back (a);
+
+      set<int> existsIds;
+      for (int i = 0; i < vars.size(); i++)
+      {
+        Expr c = mkCanonConst (vars[i], i);
+        if (c == NULL) return;   // e.g., uninterpreted functions
+        toCanon[vars[i]] = c;
+        fromCanon[c] = vars[i];
+        if (t_quantified.count (vars[i]) > 0)
+        {
+          existsIds.insert (i);
+          exists.insert (c);
+        }
+      }
+
+      EZ3 z3 (efac);
+      Expr cs = replaceAll (s, toCanon);
+      Expr ct = replaceAll (t, toCanon);
+
+      ostringstream k;
+      k << "compact " << compact << " split " << split << " tree " << tree
+        << " order " << order << "\ntrace " << samples.size () << "\n" << samples << "\nexists";
+      for (int i : existsIds) k << " " << i;
+      k << "\n" << z3.toSmtLibDecls (mk<AND>(cs, ct))
+        << "(assert " << z3.toSmtLib (cs) << ")\n"
+        << "(assert " << z3.toSmtLib (ct) << ")\n";
+      key = k.str ();
+
+      if (mkdir (dir, 0755) != 0 && errno != EEXIST)
+      {
+        string reason = strerror (errno);
+        outs () << "Unable to create the cache directory " << dir << ": " << reason << "\n";
+        return;
+      }
+      ostringstream p;
+      p << dir << "/" << hex << hash (key) << ".ae";
+      path = p.str ();
+    }
+
+    bool hasExistentials (Expr e)
+    {
+      ExprSet vars;
+      filter (e, bind::IsConst (), inserter (vars, vars.begin ()));
+      for (auto &v : vars) if (exists.count (v) > 0) return true;
+      return false;
+    }
+
+    /**
+     * Whether skol is a tree of ITEs (over universals) whose leaves assign each existential
+     * at most once: via (= var def), var or (not var). Dependencies between the assigned
+     * existentials are collected to deps
+     */
+    bool isDefinition (Expr skol, ExprSet &assigned, map<Expr, ExprSet> &deps)
+    {
+      if (isOpX<TRUE>(skol)) return true;
+      if (isOpX<ITE>(skol))
+      {
+        if (hasExistentials (skol->arg (0))) return false;
+        ExprSet assignedThen = assigned;
+        return isDefinition (skol->arg (1), assignedThen, deps) &&
+               isDefinition (skol->arg (2), assigned, deps);
+      }
+      if (isOpX<AND>(skol))
+      {
+        for (auto it = skol->args_begin (), end = skol->args_end (); it != end; ++it)
+          if (!isDefinition (*it, assigned, deps)) return false;
+        return true;
+      }
+
+      Expr var, def;
+      if ((isOpX<EQ>(skol) || isOpX<IFF>(skol)) && exists.count (skol->left ()) > 0)
+      {
+        var = skol->left ();
+        def = skol->right ();
+      }
+      else if ((isOpX<EQ>(skol) || isOpX<IFF>(skol)) && exists.count (skol->right ()) > 0)
+      {
+        var = skol->right ();
+        def = skol->left ();
+      }
+      else if (exists.count (skol) > 0) var = skol;
+      else if (isOpX<NEG>(skol) && exists.count (skol->left ()) > 0) var = skol->left ();
+      else return false;
+
+      if (!assigned.insert (var).second) return false;
+      if (def != NULL)
+      {
+        ExprSet vars;
+        filter (def, bind::IsConst (), inserter (vars, vars.begin ()));
+        for (auto &v : vars) if (exists.count (v) > 0) deps[var].insert (v);
+      }
+      return true;
+    }
+
+    static bool isCyclic (Expr v, map<Expr, ExprSet> &deps, map<Expr, int> &state)
+    {
+      int &st = state[v];
+      if (st == 1) return true;
+      if (st == 2) return false;
+      st = 1;
+      for (auto &d : deps[v]) if (isCyclic (d, deps, state)) return true;
+      state[v] = 2;
+      return false;
+    }
+
+    /**
+     * A Skolem assigning every existential at most once per branch, acyclically, has a model
+     * for any values of the universals: e.g., false or a bare constraint is rejected
+     */
+    bool isTotal (Expr skol)
+    {
+      ExprSet assigned;
+      map<Expr, ExprSet> deps;
+      if (!isDefinition (skol, assigned, deps)) return false;
+      map<Expr, int> state;
+      for (auto &d : deps) if (isCyclic (d.first, deps, state)) return false;
+      return true;
+    }
+
+    /**
+     * Fetch the iterations count and the Skolem of an equal query; the Skolem is total on S,
+     * but it is not yet verified to satisfy T
+     */
+    bool lookup (int &iters, Expr &skol)
+    {
+      if (path.empty ()) return false;
+      ifstream in (path.c_str (), ios::binary);
+      if (!in) return false;
+
+      string header;
+      getline (in, header);
+      if (header != "aeval-cache " + lexical_cast<string>(version)) return false;
+
+      // -- hashes may collide: compare the whole key
+      size_t len;
+      in >> len;
+      in.get ();
+      string k (len, '\0');
+      in.read (&k[0], len);
+      if (!in || k != key) return false;
+
+      string res;
+      in >> res >> iters;
+      if (!in || res != "valid") return false;
+
+      in.get ();
+      string body ((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+      ExprVector sk;
+      if (!bin::read (body.data (), body.size (), efac, sk) || sk.size () != 1) return false;
+      if (!isTotal (sk[0])) return false;
+      skol = replaceAll (sk[0], fromCanon);
+      return true;
+    }
+
+    void store (int iters, Expr skol)
+    {
+      if (path.empty ()) return;
+
+      string cskol;
+      if (!bin::write (ExprVector (1, replaceAll (skol, toCanon)), cskol)) return;
+
+      // -- write a private file first, so that readers never see a partial entry
+      string tmp = path + "." + lexical_cast<string>(getpid ());
+      {
+        ofstream out (tmp.c_str (), ios::binary);
+        out << "aeval-cache " << version << "\n"
+            << key.size () << "\n" << key
+            << "valid " << iters << "\n"
+            << cskol;
+        if (!out)
+        {
+          out.close ();
+          remove (tmp.c_str ());
+          return;
+        }
+      }
+      if (rename (tmp.c_str (), path.c_str ()) != 0) remove (tmp.c_str ());
+    }
+  };
+}
+
+#endif
@@ -1,8 +1,14 @@
 #ifndef AEVALSOLVER__HPP__
 #define AEVALSOLVER__HPP__
 #include <assert.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <random>
 
 #include "ae/SMTUtils.hpp"
+#include "ae/LinearForm.hpp"
+#include "ae/AeCache.hpp"
+#include "ae/SkolemC.hpp"
 #include "ufo/Smt/EZ3.hh"
 
 using namespace std;
@@ -22,7 +28,8 @@ namespace ufo
     ExprVector stVars;
 
     ExprSet tConjs;
-    ExprSet usedConjs;
+    ExprHashSet usedConjs;
+    map<Expr, ExprVector> defConjs; // var -> conjuncts of T that may define it
     ExprMap defMap;
     ExprMap cyclicDefs;
     ExprMap modelInvalid;
@@ -43,11 +50,15 @@ namespace ufo
     map<Expr, ExprVector> skolemConstraints;
     bool skol;
     bool debug;
+    bool gen; // generalize projections before blocking
+    static const unsigned maxTreeAtoms = 32; // candidate splits of a decision-tree Skolem
+    vector<ConcreteModel> samples; // inputs, to order the branches of the Skolem
+    static const unsigned maxSamples = 64;
     unsigned fresh_var_ind;
 
   public:
 
-    AeValSolver (Expr _s, Expr _t, ExprSet &_v, bool _debug, bool _skol) :
+    AeValSolver (Expr _s, Expr _t, ExprSet &_v, bool _debug, bool _skol, bool _gen = false) :
       s(_s), t(_t), v(_v),
       efac(s->getFactory()),
       z3(efac),
@@ -56,11 +67,13 @@ namespace ufo
       fresh_var_ind(0),
       partitioning_size(0),
       skol(_skol),
-      debug(_debug)
+      debug(_debug),
+      gen(_gen)
     {
       filter (s, bind::IsConst (), back_inserter (sVars));
       filter (boolop::land(s,t), bind::IsConst (), back_inserter (stVars));
       getConj(t, tConjs);
+      for (auto &cnj: tConjs) indexDefConj(cnj);
 
       for (auto &exp: v) {
         if (!bind::isBoolConst(exp)) continue;
@@ -77,40 +90,65 @@ namespace ufo
       splitDefs(defMap, cyclicDefs);
     }
 
-    void splitDefs (ExprMap &m1, ExprMap &m2, int curCnt = 0)
+    /**
+     * Substitute definitions into each other in a topological order (single sweep).
+     * Afterwards, m1 has all definitions resolved as far as possible,
+     * and m2 gets the ones that still depend on v (e.g., cyclic)
+     */
+    void splitDefs (ExprMap &m1, ExprMap &m2)
     {
-      ExprMap m3;
-      ExprMap m4;
+      map<Expr, ExprFlatSet> deps;
+      map<Expr, ExprVector> users;
+      map<Expr, int> unresolved;
+      ExprVector order;
       for (auto & a : m1)
       {
         if (a.second == NULL) continue;
-        if (emptyIntersect(a.second, v))
-        {
-          m3.insert(a);
-        }
-        else
-        {
-          m4.insert(a);
-        }
+        ExprFlatSet vars;
+        getConsts (a.second, vars);
+        ExprFlatSet &d = deps[a.first];
+        for (auto & b : vars) if (v.find(b) != v.end()) d.insert(b);
+        for (auto & b : d) users[b].push_back(a.first);
+        unresolved[a.first] = d.size();
+        if (d.empty()) order.push_back(a.first);
       }
-      if (m3.size() == curCnt)
+
+      ExprMap resolved;
+      for (int i = 0; i < order.size(); i++)
       {
-        m2 = m4;
-        return;
+        Expr a = order[i];
+        Expr &def = m1[a];
+        ExprVector fromVars;
+        ExprVector toDefs;
+        for (auto & b : deps[a])
+        {
+          fromVars.push_back(b);
+          toDefs.push_back(resolved[b]);
+        }
+        if (!fromVars.empty()) def = replaceAll(def, fromVars, toDefs);
+        resolved[a] = def;
+
+        for (auto & b : users[a])
+          if (--unresolved[b] == 0) order.push_back(b);
       }
 
-      for (auto & a : m3)
+      m2.clear();
+      for (auto & a : deps)
       {
-        for (auto & b : m1)
+        if (resolved.find(a.first) != resolved.end()) continue;
+        ExprVector fromVars;
+        ExprVector toDefs;
+        for (auto & b : a.second)
         {
-          if (b.second == NULL) continue;
-          if (a.first != b.first)
-          {
-            b.second = replaceAll(b.second, a.first, a.second);
-          }
+          auto r = resolved.find(b);
+          if (r == resolved.end()) continue;
+          fromVars.push_back(b);
+          toDefs.push_back(r->second);
         }
+        Expr &def = m1[a.first];
+        if (!fromVars.empty()) def = replaceAll(def, fromVars, toDefs);
+        m2[a.first] = def;
       }
-      splitDefs(m1, m2, m3.size());
     }
 
     /**
@@ -139,16 +177,22 @@ namespace ufo
         return res;
       }
 
-      smt.push ();
-      smt.assertExpr (t);
+      // t is asserted once under an activation literal, so the learned clauses
+      // about it survive across iterations (no push/pop)
+      string ind = lexical_cast<string> (fresh_var_ind++);
+      Expr tAct = bind::boolConst(mkTerm ("_aeval_tmp_act_" + ind, efac));
+      smt.assertExpr (mk<IMPL>(tAct, t));
+      ExprVector assumptions;
+      assumptions.push_back(tAct);
 
       boost::tribool res = true;
 
-      while (smt.solve ())
+      while (smt.solveAssuming (assumptions))
       {
         outs().flush ();
 
         ZSolver<EZ3>::Model m = smt.getModel();
+        u.addModel(m, stVars);
 
         if (debug && false)
         {
@@ -162,7 +206,7 @@ namespace ufo
         }
 
         getMBPandSkolem(m);
-        smt.pop();
+        if (gen) generalizeProjection();
         smt.assertExpr(boolop::lneg(projections.back()));
         if (!smt.solve()) {
           res = false; break;
@@ -172,9 +216,6 @@ namespace ufo
           for (auto &e: sVars)
             modelInvalid[e] = m.eval(e);
         }
-
-        smt.push();
-        smt.assertExpr (t);
       }
       return res;
     }
@@ -202,6 +243,75 @@ namespace ufo
       partitioning_size++;
     }
 
+    /**
+     * Weaken the last projection to a subset of its conjuncts on which a ground
+     * witness (definitions from T, or else model values) still satisfies T,
+     * i.e., s /\ pr' /\ !t[v := w] is unsat; the witness becomes the local Skolem.
+     */
+    void generalizeProjection()
+    {
+      if (isOpX<TRUE>(projections.back())) return;
+
+      ExprMap &evals = someEvals.back();
+      ExprMap witn;
+      ExprVector vars;
+      ExprVector vals;
+      for (auto & a : v)
+      {
+        auto d = defMap.find(a);
+        if (d != defMap.end() && d->second != NULL && emptyIntersect(d->second, v))
+          witn[a] = mk<EQ>(a, d->second);
+        else if (evals.find(a) != evals.end())
+          witn[a] = evals[a];
+        else return;
+
+        vars.push_back(a);
+        vals.push_back(witn[a]->right());
+      }
+
+      ExprSet lits;
+      getConj(projections.back(), lits);
+
+      ZSolver<EZ3> gsmt (z3);
+      gsmt.assertExpr(s);
+      gsmt.assertExpr(mk<NEG>(replaceAll(t, vars, vals)));
+
+      ExprVector inds;
+      ExprMap indToLit;
+      for (auto & a : lits)
+      {
+        string ind = lexical_cast<string> (fresh_var_ind++);
+        Expr indVar = bind::boolConst(mkTerm ("_aeval_tmp_gen_" + ind, efac));
+        gsmt.assertExpr(mk<IMPL>(indVar, a));
+        inds.push_back(indVar);
+        indToLit[indVar] = a;
+      }
+
+      ExprVector core;
+      boost::tribool res = gsmt.solveAssuming(inds, back_inserter(core));
+      if (res || indeterminate(res)) return;
+
+      // drop the remaining redundant literals one by one
+      for (int i = 0; i < core.size(); )
+      {
+        ExprVector tmp = core;
+        tmp.erase(tmp.begin() + i);
+        if (!gsmt.solveAssuming(tmp)) core = tmp;
+        else i++;
+      }
+
+      ExprSet cnjs;
+      for (auto & a : core) cnjs.insert(indToLit[a]);
+
+      if (cnjs.size() == lits.size()) return;
+
+      if (debug) outs () << "generalized projection: " << lits.size()
+                         << " -> " << cnjs.size() << " literals\n";
+
+      projections.back() = conjoin(cnjs, efac);
+      skolMaps.back() = witn;
+    }
+
     void fillSubsts (Expr ef, Expr es, Expr mbp, ExprSet& substs)
     {
       if (!sameBoolOrCmp(ef, es))
@@ -310,7 +420,7 @@ namespace ufo
         ExprSet cnjs;
         for (auto & p : pprs) cnjs.insert(conjoin(p, efac));
 
-        if (!cnjs.empty()) common.insert(simplifyBool(disjoin(cnjs, efac)));
+        if (!cnjs.empty()) common.insert(simplify(disjoin(cnjs, efac)));
         prs = conjoin(common, efac);
       }
       else
@@ -348,25 +458,37 @@ namespace ufo
       }
     }
 
+    /**
+     * Index the conjuncts of T that may define a variable: `var`, `!var`, `var = ...`
+     */
+    void indexDefConj(Expr cnj)
+    {
+      if (bind::isBoolConst(cnj))
+      {
+        defConjs[cnj].push_back(cnj);
+      }
+      else if (isOpX<NEG>(cnj) && bind::isBoolConst(cnj->left()))
+      {
+        defConjs[cnj->left()].push_back(cnj);
+      }
+      else if (isOpX<EQ>(cnj))
+      {
+        defConjs[cnj->left()].push_back(cnj);
+        if (cnj->right() != cnj->left()) defConjs[cnj->right()].push_back(cnj);
+      }
+    }
+
     /**
      * Mine the structure of T to get what was assigned to a variable
      */
     Expr getDefinitionFormulaFromT(Expr var)
     {
       ExprSet defs;
-      for (auto & cnj : tConjs)
+      for (auto & cnj : defConjs[var])
       {
         // get equality (unique per variable)
-        if (std::find(std::begin(usedConjs),
-                      std::end  (usedConjs), cnj) != std::end(usedConjs)) continue;
-
-        if (isOpX<EQ>(cnj))
-        {
-          if (var == cnj->left() || var == cnj->right())
-          {
-            defs.insert(cnj);
-          }
-        }
+        if (usedConjs.count(cnj) > 0) continue;
+        if (isOpX<EQ>(cnj)) defs.insert(cnj);
       }
 
       // now find `the best` one
@@ -389,17 +511,16 @@ namespace ufo
     Expr getBoolDefinitionFormulaFromT(Expr var)
     {
       Expr def;
-      for (auto & cnj : tConjs)
+      for (auto & cnj : defConjs[var])
       {
-        if (std::find(std::begin(usedConjs),
-                      std::end  (usedConjs), cnj) != std::end(usedConjs)) continue;
+        if (usedConjs.count(cnj) > 0) continue;
 
-        if (bind::isBoolConst(cnj) && var == cnj)
+        if (var == cnj)
         {
           def = mk<TRUE>(efac);
           usedConjs.insert(cnj);
         }
-        else if (isOpX<NEG>(cnj) && bind::isBoolConst(cnj->left()) && var == cnj->left())
+        else if (isOpX<NEG>(cnj))
         {
           def = mk<FALSE>(efac);
           usedConjs.insert(cnj);
@@ -412,43 +533,27 @@ namespace ufo
 
     void extendTWithDefs(Expr var, Expr def)
     {
-      for (auto & cnj : tConjs)
+      ExprVector &cnjs = defConjs[var];
+      for (int i = 0; i < cnjs.size(); i++)
       {
-        if (std::find(std::begin(usedConjs),
-                      std::end  (usedConjs), cnj) != std::end(usedConjs)) continue;
+        Expr cnj = cnjs[i];
+        if (usedConjs.count(cnj) > 0 || !isOpX<EQ>(cnj)) continue;
 
-        if (isOpX<EQ>(cnj))
+        usedConjs.insert(cnj);
+        Expr other = (var == cnj->left()) ? cnj->right() : cnj->left();
+        if (def == NULL)
         {
-          if (var == cnj->left())
-          {
-            usedConjs.insert(cnj);
-            if (def == NULL)
-            {
-              def = cnj->right();
-              break;
-            }
-            else
-            {
-              getConj(isOpX<TRUE>(def) ? cnj->right() : mk<NEG> (cnj->right()), tConjs);
-            }
-          }
-          else if (var == cnj->right())
-          {
-            usedConjs.insert(cnj);
-            if (def == NULL)
-            {
-              def = cnj->left();
-              break;
-            }
-            else
-            {
-              getConj(isOpX<TRUE>(def) ? cnj->left() : mk<NEG> (cnj->left()), tConjs);
-            }
-          }
-
-          if (debug && tConjs.empty())
-            outs () << "WARNING: getBoolDefinitionFormulaFromT has cleared tConjs\n";
+          def = other;
+          break;
         }
+
+        ExprSet newConjs;
+        getConj(isOpX<TRUE>(def) ? other : mk<NEG> (other), newConjs);
+        for (auto & c : newConjs)
+          if (tConjs.insert(c).second) indexDefConj(c);
+
+        if (debug && tConjs.empty())
+          outs () << "WARNING: getBoolDefinitionFormulaFromT has cleared tConjs\n";
       }
     }
 
@@ -472,104 +577,135 @@ namespace ufo
     }
 
     /**
-     * Self explanatory
+     * Balanced tree of ITE-s for the max (or min) of cands[lo..hi)
      */
-    void getSymbolicMax(ExprSet& vec, Expr& curMax, bool isInt)
+    Expr getExtremumTree(ExprVector& cands, int lo, int hi, bool isMax)
     {
-      if (vec.size() == 0) return;
-      ExprVector replFrom;
-      ExprVector replTo;
-      curMax = *vec.begin();
-      if (vec.size() == 1) return;
-      for (auto it = vec.begin(); ++it != vec.end(); ){
-        auto &a = *it;
-        if (u.isEquiv(mk<LT>(curMax, a), mk<TRUE>(efac))){
-          curMax = a;
-        } else if (u.isEquiv(mk<LT>(curMax, a), mk<FALSE>(efac))){
-          //  curMax is OK
-        } else {
-          string ind = lexical_cast<string> (fresh_var_ind++);
+      if (hi - lo == 1) return cands[lo];
+      int mid = (lo + hi) / 2;
+      Expr l = getExtremumTree(cands, lo, mid, isMax);
+      Expr r = getExtremumTree(cands, mid, hi, isMax);
+      if (isMax) return mk<ITE>(mk<LT>(l, r), r, l);
+      else return mk<ITE>(mk<GT>(l, r), r, l);
+    }
 
-          Expr varName = mkTerm ("_aeval_tmp_max_" + ind, efac);
-          Expr var = isInt ? bind::intConst(varName) : bind::realConst(varName);
+    /**
+     * Symbolic max (or min) of vec. Among bounds that differ only by a constant,
+     * the best one is kept syntactically; every remaining bound is dropped if it
+     * never beats all the others (one check per bound, in a single solver)
+     */
+    Expr getSymbolicExtremum(ExprSet& vec, bool isMax, bool isInt)
+    {
+      ExprVector cands;
+      vector<mpq_class> csts;
+      map<Expr, int> keyToInd;  // non-constant part -> index in cands
+      for (auto & a : vec)
+      {
+        LinearForm lf;
+        Expr key = NULL;
+        mpq_class c = 0;
+        if (lf.fromExpr(a))
+        {
+          c = lf.cst;
+          lf.cst = 0;
+          key = lf.toExpr(efac, isInt);
+        }
+        if (key == NULL)
+        {
+          key = a;
+          c = 0;
+        }
 
-          replFrom.push_back(var);
-          replTo.push_back(mk<ITE>(mk<LT>(curMax, a), a, curMax));
+        auto it = keyToInd.find(key);
+        if (it == keyToInd.end())
+        {
+          keyToInd[key] = cands.size();
+          cands.push_back(a);
+          csts.push_back(c);
+          continue;
+        }
+        int i = it->second;
+        if (isMax ? c > csts[i] : c < csts[i])
+        {
+          cands[i] = a;
+          csts[i] = c;
+        }
+      }
 
-          curMax = var;
+      if (cands.size() > 1)
+      {
+        ZSolver<EZ3> dsmt (z3);
+        vector<bool> alive(cands.size(), true);
+        for (int i = 0; i < cands.size(); i++)
+        {
+          ExprSet beats;
+          for (int j = 0; j < cands.size(); j++)
+            if (j != i && alive[j])
+              beats.insert(isMax ? mk<GT>(cands[i], cands[j]) : mk<LT>(cands[i], cands[j]));
+
+          dsmt.push();
+          dsmt.assertExpr(conjoin(beats, efac));
+          if (!dsmt.solve()) alive[i] = false;   // unknown keeps the bound
+          dsmt.pop();
         }
+        ExprVector tmp;
+        for (int i = 0; i < cands.size(); i++) if (alive[i]) tmp.push_back(cands[i]);
+        cands = tmp;
       }
-      for (int i = replFrom.size() - 1; i >= 0; i--)
-        curMax = replaceAll(curMax, replFrom[i], replTo[i]);
+
+      assert(!cands.empty());
+      return getExtremumTree(cands, 0, cands.size(), isMax);
     }
 
     /**
      * Self explanatory
      */
-    void getSymbolicMin(ExprSet& vec, Expr& curMin, bool isInt)
+    void getSymbolicMax(ExprSet& vec, Expr& curMax, bool isInt)
     {
       if (vec.size() == 0) return;
-      ExprVector replFrom;
-      ExprVector replTo;
-      curMin = *vec.begin();
-      if (vec.size() == 1) return;
-      for (auto it = vec.begin(); ++it != vec.end(); ){
-        auto &a = *it;
-        if (u.isEquiv(mk<GT>(curMin, a), mk<TRUE>(efac))){
-          curMin = a;
-        } else if (u.isEquiv(mk<GT>(curMin, a), mk<FALSE>(efac))){
-          //  curMin is OK
-        } else {
-          string ind = lexical_cast<string> (fresh_var_ind++);
-
-          Expr varName = mkTerm ("_aeval_tmp_min_" + ind, efac);
-          Expr var = isInt ? bind::intConst(varName) : bind::realConst(varName);
+      curMax = getSymbolicExtremum(vec, true, isInt);
+    }
 
-          replFrom.push_back(var);
-          replTo.push_back(mk<ITE>(mk<GT>(curMin, a), a, curMin));
+    /**
+     * Self explanatory
+     */
+    void getSymbolicMin(ExprSet& vec, Expr& curMin, bool isInt)
+    {
+      if (vec.size() == 0) return;
+      curMin = getSymbolicExtremum(vec, false, isInt);
+    }
 
-          curMin = var;
-        }
-      }
-      for (int i = replFrom.size() - 1; i >= 0; i--)
-        curMin = replaceAll(curMin, replFrom[i], replTo[i]);
+    /**
+     * Sort vec ascending by Batcher's odd-even merge network of ITE-s
+     */
+    void getSymbolicSort(ExprVector& vec)
+    {
+      int n = vec.size();
+      for (int p = 1; p < n; p *= 2)
+        for (int k = p; k >= 1; k /= 2)
+          for (int j = k % p; j + k < n; j += 2 * k)
+            for (int i = 0; i < k && i + j + k < n; i++)
+            {
+              int a = i + j, b = i + j + k;
+              if (a / (2 * p) != b / (2 * p)) continue;
+              Expr le = mk<LEQ>(vec[a], vec[b]);
+              Expr lo = mk<ITE>(le, vec[a], vec[b]);
+              vec[b] = mk<ITE>(le, vec[b], vec[a]);
+              vec[a] = lo;
+            }
     }
 
+    /**
+     * The least lower + k * eps (k <= vec.size()) that differs from all values in
+     * vec: the values are sorted once, then skipped in a single ascending pass
+     */
     void getSymbolicNeq(ExprSet& vec, Expr& lower, Expr& curNeq, Expr eps, bool isInt)
     {
-      ExprVector replFrom;
-      ExprVector replTo;
-
-      Expr var1 = lower;
-      Expr eps1;
-
-      string ind = lexical_cast<string> (fresh_var_ind++);
-      Expr varName = mkTerm ("_aeval_tmp_neq_" + ind, efac);
-      Expr var2 = isInt ? bind::intConst(varName) : bind::realConst(varName);
-
-      curNeq = var2;
-      for (int i = 0; i < vec.size(); i++)
-      {
-        ExprSet neqqedConstrs;
-        for (auto &a : vec) neqqedConstrs.insert(mk<EQ>(a, var1));
-
-        string ind = lexical_cast<string> (fresh_var_ind++);
-        Expr varName = mkTerm ("_aeval_tmp_neq_" + ind, efac);
-        Expr newVar = isInt ? bind::intConst(varName) : bind::realConst(varName);
-
-        replFrom.push_back(var2);
-        replTo.push_back(mk<ITE>(disjoin(neqqedConstrs, efac), newVar, var1));
-
-        eps1 = multVar(eps, i+1);
-        var1 = mk<PLUS>(lower, eps1);
-        var2 = newVar;
-      }
-
-      replFrom.push_back(var2);
-      replTo.push_back(var1);
-
-      for (int i = 0; i < replFrom.size(); i++)
-        curNeq = replaceAll(curNeq, replFrom[i], replTo[i]);
+      ExprVector sorted(vec.begin(), vec.end());
+      getSymbolicSort(sorted);
+      curNeq = lower;
+      for (auto & a : sorted)
+        curNeq = mk<ITE>(mk<EQ>(a, curNeq), mk<PLUS>(curNeq, eps), curNeq);
     }
 
     /**
@@ -578,7 +714,7 @@ namespace ufo
     Expr getDefaultAssignment(Expr var)
     {
       if (bind::isBoolConst(var)) return mk<TRUE>(efac);
-      if (bind::isIntConst(var)) return mkTerm (mpz_class (0), efac);
+      if (bind::isIntConst(var)) return efac.mkZero();
       else           // that is, isRealConst(var) == true
         return mkTerm (mpq_class (0), efac);
     }
@@ -589,9 +725,9 @@ namespace ufo
     Expr plusEps(Expr e, bool isInt = true)
     {
       if (isOpX<MPZ>(e) && isInt)
-        return mkTerm (mpz_class (boost::lexical_cast<int> (e) + 1), efac);
+        return mkTerm (mpz_class (getTermRef<mpz_class> (e) + 1), efac);
 
-      if (isInt) return mk<PLUS>(e, mkTerm (mpz_class (1), efac));
+      if (isInt) return mk<PLUS>(e, efac.mkOne());
       else return mk<PLUS>(e, mkTerm (mpq_class (1), efac));
     }
 
@@ -601,9 +737,9 @@ namespace ufo
     Expr minusEps(Expr e, bool isInt = true)
     {
       if (isOpX<MPZ>(e) && isInt)
-        return mkTerm (mpz_class (boost::lexical_cast<int> (e) - 1), efac);
+        return mkTerm (mpz_class (getTermRef<mpz_class> (e) - 1), efac);
 
-      if (isInt) return mk<MINUS>(e, mkTerm (mpz_class (1), efac));
+      if (isInt) return mk<MINUS>(e, efac.mkOne());
       else return mk<MINUS>(e, mkTerm (mpq_class (1), efac));
     }
 
@@ -631,7 +767,9 @@ namespace ufo
         if (isOpX<NEG>(exp)) exp = mkNeg(exp->left());
 
         if (!bind::isBoolConst(var) && var != exp->left())
+        {
           exp = ineqReverter(ineqMover(exp, var));
+        }
         // TODO: write a similar simplifier fo booleans
 
         assert (var == exp->left());
@@ -984,7 +1122,7 @@ namespace ufo
         Expr eps;
         if (isInt)
         {
-          eps = mkTerm (mpz_class (1), efac);
+          eps = efac.mkOne();
 
           if (curMaxGE == NULL) curMax = mk<PLUS>(curMaxGT, eps);
           else if (curMaxGT == NULL) curMax = curMaxGE;
@@ -997,7 +1135,7 @@ namespace ufo
         }
 
         Expr curMid;
-        getSymbolicNeq(conjNEQ, curMax, curMid, eps, isInt); // linear scan
+        getSymbolicNeq(conjNEQ, curMax, curMid, eps, isInt);
         return curMid;
       }
 
@@ -1113,11 +1251,11 @@ namespace ufo
       map<Expr, int> tmp;
       for (auto & a : cyclicSubsts)
       {
-        ExprSet vars;
-        filter (a.second, bind::IsConst (), inserter (vars, vars.begin()));
+        ExprFlatSet vars;
+        getConsts (a.second, vars);
         for (auto & b : vars)
         {
-          if (find(v.begin(), v.end(), b) != v.end())
+          if (v.find(b) != v.end())
             tmp[b]++;
         }
       }
@@ -1165,13 +1303,13 @@ namespace ufo
     {
       if (skolMaps[i][var] != NULL && defMap[var] != NULL)
       {
-        ExprSet vars;
-        filter (defMap[var], bind::IsConst (), inserter (vars, vars.begin()));
+        ExprFlatSet vars;
+        getConsts (defMap[var], vars);
         if (vars.size() != 1) return false; //GF: to extend
         for (auto & var1 : vars)
         {
           Expr tmp = skolMaps[i][var];
-          if (find(v.begin(), v.end(), var1) != v.end() && skolMaps[i][var1] == NULL)
+          if (v.find(var1) != v.end() && skolMaps[i][var1] == NULL)
           {
             skolMaps[i][var1] = simplifyArithm(replaceAll(tmp, var, defMap[var]));;
             skolMaps[i][var] = NULL;
@@ -1182,7 +1320,144 @@ namespace ufo
       return false;
     }
 
-    Expr getSkolemFunction (bool compact = false)
+    /**
+     * How many samples fall into each projection (empty if there are no samples)
+     */
+    void getSampleHits (vector<size_t> &hits)
+    {
+      if (samples.empty ()) return;
+      hits.assign (partitioning_size, 0);
+      for (int i = 0; i < partitioning_size; i++)
+      {
+        EvalProgram prog (projections[i]);
+        for (auto & m : samples)
+          if (m.covers (projections[i]) && prog.runBool (m) == true) hits[i]++;
+      }
+      if (debug)
+      {
+        outs () << "Samples in projections:";
+        for (auto h : hits) outs () << " " << h;
+        outs () << " (of " << samples.size () << ")\n";
+      }
+    }
+
+    /**
+     * Atoms (comparisons and Boolean constants) of the projections, the most frequent first
+     */
+    void getTreeAtoms (ExprVector &atoms)
+    {
+      map<Expr, int> freq;
+      for (auto & p : projections)
+      {
+        ExprSet lits;
+        filter (p, IsLiteral (), inserter (lits, lits.begin()));
+        for (auto & a : lits)
+        {
+          Expr na = mkNeg (a);
+          if (freq.count (na) > 0) freq[na]++;
+          else freq[a]++;
+        }
+      }
+      vector<pair<int, Expr>> byFreq;
+      for (auto & a : freq) byFreq.push_back (make_pair (-a.second, a.first));
+      stable_sort (byFreq.begin(), byFreq.end(),
+                   [](const pair<int, Expr> &a, const pair<int, Expr> &b) { return a.first < b.first; });
+      for (int k = 0; k < byFreq.size() && k < maxTreeAtoms; k++) atoms.push_back (byFreq[k].second);
+    }
+
+    /**
+     * Whether (within S) projections[i] implies atom (1), its negation (-1), or
+     * neither (0); computed on demand, 2 if not yet known
+     */
+    int getTreeRel (int i, int k, ExprVector &atoms, vector<vector<int>> &rel)
+    {
+      int &r = rel[i][k];
+      if (r != 2) return r;
+      Expr pre = mk<AND>(s, projections[i]);
+      if (u.implies (pre, atoms[k])) r = 1;
+      else if (u.implies (pre, mkNeg (atoms[k]))) r = -1;
+      else r = 0;
+      return r;
+    }
+
+    /**
+     * Decision tree over the atoms of projections. Cands are the partitions still
+     * possible under path (atoms[k] is k+1 in path, its negation is -k-1), in the
+     * order of priority of the ITE chain, and asgns[i] is the assignment for the
+     * i-th one. Splits on the atom that leaves the fewest candidates on the worse
+     * side; falls back to an ITE chain if no atom splits
+     */
+    Expr getDecisionTree (vector<int> &path, vector<int> cands, ExprVector &asgns,
+                          ExprVector &atoms, vector<vector<int>> &rel)
+    {
+      // -- drop the partitions that can not hold under path
+      if (!path.empty ())
+      {
+        vector<int> feasible;
+        for (int i : cands)
+        {
+          bool known = true, sat = true;
+          for (int l : path)
+          {
+            int r = getTreeRel (i, abs (l) - 1, atoms, rel);
+            if (r == 0) known = false;
+            else if ((r > 0) != (l > 0)) sat = false;
+          }
+          if (sat && !known)
+          {
+            ExprVector cnjs;
+            for (int l : path) cnjs.push_back (l > 0 ? atoms[l - 1] : mkNeg (atoms[-l - 1]));
+            cnjs.push_back (s);
+            cnjs.push_back (projections[i]);
+            sat = u.isSat (cnjs);
+          }
+          if (sat) feasible.push_back (i);
+        }
+        if (feasible.empty ()) return asgns[cands[0]];  // unreachable within S
+        cands = feasible;
+      }
+
+      bool same = true;
+      for (int i : cands) same &= (asgns[i] == asgns[cands[0]]);
+      if (same) return asgns[cands[0]];
+
+      int best = -1;
+      int bestScore = cands.size ();
+      for (int k = 0; k < atoms.size() && 2 * bestScore > cands.size () + 1; k++)
+      {
+        if (find (path.begin(), path.end(), k + 1) != path.end() ||
+            find (path.begin(), path.end(), -k - 1) != path.end()) continue;
+        int keepT = 0, keepF = 0;
+        for (int i : cands)
+        {
+          int r = getTreeRel (i, k, atoms, rel);
+          if (r != -1) keepT++;
+          if (r != 1) keepF++;
+        }
+        if (max (keepT, keepF) < bestScore)
+        {
+          bestScore = max (keepT, keepF);
+          best = k;
+        }
+      }
+
+      if (best < 0)
+      {
+        Expr res = asgns[cands.back ()];
+        for (int k = cands.size () - 2; k >= 0; k--)
+          if (asgns[cands[k]] != res) res = mk<ITE>(projections[cands[k]], asgns[cands[k]], res);
+        return res;
+      }
+
+      path.push_back (best + 1);
+      Expr thenSkol = getDecisionTree (path, cands, asgns, atoms, rel);
+      path.back () = -best - 1;
+      Expr elseSkol = getDecisionTree (path, cands, asgns, atoms, rel);
+      path.pop_back ();
+      return thenSkol == elseSkol ? thenSkol : mk<ITE>(atoms[best], thenSkol, elseSkol);
+    }
+
+    Expr getSkolemFunction (bool compact = false, bool tree = false)
     {
       if (partitioning_size == 0)
         return mk<TRUE>(efac);
@@ -1286,7 +1561,7 @@ namespace ufo
       for (auto & var : sensitiveVars)
       {
         bestIndexes.clear();
-        if (find(eligibleVars.begin(), eligibleVars.end(), var) != eligibleVars.end()
+        if (eligibleVars.count(var) > 0
             && compact)
         {
           set<int> indexes;
@@ -1316,6 +1591,9 @@ namespace ufo
           if (found) intersect.insert(i);
         }
 
+        vector<size_t> hits;
+        getSampleHits(hits);
+
         if (intersect.size() <= 1)
         {
           int maxSz = 0;
@@ -1329,6 +1607,14 @@ namespace ufo
               largestPre = i;
             }
           }
+          // -- with samples: the guard that is least worth testing is left out
+          if (!hits.empty())
+            for (int i = 0; i < partitioning_size; i++)
+              if (hits[i] * maxSz < hits[largestPre] * treeSize(projections[i]))
+              {
+                maxSz = treeSize(projections[i]);
+                largestPre = i;
+              }
           intersect.clear();
           intersect.insert(largestPre);
         }
@@ -1352,6 +1638,8 @@ namespace ufo
           }
         }
 
+        ExprVector asgns (partitioning_size, bigSkol);
+        vector<int> order;
         for (int i = 0; i < partitioning_size; i++)
         {
           allAssms = sameAssms;
@@ -1362,10 +1650,38 @@ namespace ufo
               Expr def = getAssignmentForVar(a, skolemConstraints[a][i]);
               allAssms[a] = def;
             }
-            bigSkol = mk<ITE>(projections[i], combineAssignments(allAssms, someEvals[i]), bigSkol);
+            asgns[i] = combineAssignments(allAssms, someEvals[i]);
+            order.push_back(i);
+          }
+        }
+
+        // -- by default, later partitions are tested first
+        if (!hits.empty())
+          stable_sort(order.begin(), order.end(), [&](int a, int b) {
+              return hits[a] * treeSize(projections[b]) < hits[b] * treeSize(projections[a]); });
+
+        if (!tree)
+        {
+          for (int i : order)
+          {
+            bigSkol = mk<ITE>(projections[i], asgns[i], bigSkol);
             if (compact) bigSkol = u.simplifyITE(bigSkol);
           }
         }
+        else
+        {
+          // -- same priorities as in the chain, intersect last
+          vector<int> cands (order.rbegin(), order.rend());
+          for (int i : intersect) cands.push_back(i);
+
+          ExprVector atoms;
+          getTreeAtoms(atoms);
+          vector<vector<int>> rel (partitioning_size, vector<int> (atoms.size(), 2));
+
+          vector<int> path;
+          bigSkol = getDecisionTree(path, cands, asgns, atoms, rel);
+          if (compact) bigSkol = u.simplifyITE(bigSkol);
+        }
 
         for (auto & a : sensitiveVars) separateSkols [a] = projectITE (bigSkol, a);
 
@@ -1376,6 +1692,74 @@ namespace ufo
 
     Expr getSeparateSkol (Expr v) { return separateSkols [v]; }
 
+    /**
+     * Sample models of S by the solver, under random bounds on its numeric constants
+     */
+    void sampleInputs ()
+    {
+      std::mt19937 rnd (0);
+      ZSolver<EZ3> sampler (z3);
+      for (unsigned k = 0; k < 2 * maxSamples && samples.size () < maxSamples; k++)
+      {
+        sampler.reset ();
+        sampler.assertExpr (s);
+        for (auto & a : sVars)
+        {
+          if (bind::isBoolConst (a) || rnd () % 2 == 0) continue;
+          int bound = (int) (rnd () % 257) - 128;
+          Expr c = bind::isIntConst (a) ? mkTerm (mpz_class (bound), efac) :
+                                          mkTerm (mpq_class (bound), efac);
+          if (rnd () % 2 == 0) sampler.assertExpr (mk<LEQ>(a, c));
+          else sampler.assertExpr (mk<GEQ>(a, c));
+        }
+        if (sampler.solve ())
+        {
+          ZSolver<EZ3>::Model m = sampler.getModel ();
+          samples.push_back (ConcreteModel ());
+          getConcreteModel (m, sVars, samples.back ());
+        }
+      }
+    }
+
+    /**
+     * Read samples of the inputs (e.g., a trace of the deployed system): one per
+     * line, as name=value pairs, where a value is true, false, or a number
+     * (e.g., -3, 1/2, 0.25). Returns false if the file can not be read
+     */
+    bool readInputs (const char *fname)
+    {
+      ifstream in (fname);
+      if (!in) return false;
+      map<string, Expr> byName;
+      for (auto & a : sVars)
+      {
+        ostringstream o;
+        o << *a;
+        byName[o.str ()] = a;
+      }
+
+      string line, tok;
+      while (getline (in, line))
+      {
+        if (line.empty () || line[0] == '#') continue;
+        istringstream l (line);
+        ConcreteModel m;
+        while (l >> tok)
+        {
+          size_t eq = tok.find ('=');
+          if (eq == string::npos) continue;
+          auto it = byName.find (tok.substr (0, eq));
+          if (it == byName.end ()) continue;
+          string val = tok.substr (eq + 1);
+          mpq_class q;
+          if (val == "true" || val == "false") m.set (it->second, EvalVal::mkBool (val == "true"));
+          else if (parseNumeral (val, q)) m.set (it->second, EvalVal::mkNum (q));
+        }
+        if (m.size () > 0) samples.push_back (m);
+      }
+      return true;
+    }
+
     int getPartitioningSize() { return partitioning_size; }
 
     // Runnable only after getSkolemFunction
@@ -1388,10 +1772,307 @@ namespace ufo
     }
   };
 
+  /**
+   * Split the conjuncts of T into clusters that share no existentially quantified vars
+   * (conjuncts over the universally quantified vars only are attached to the first cluster)
+   */
+  inline void getExistentialClusters(Expr t, ExprSet &t_quantified,
+                                     ExprVector& clusters, vector<ExprSet>& clusterVars)
+  {
+    ExprSet cnjs;
+    getConj(t, cnjs);
+
+    // union-find over the existentially quantified vars
+    ExprMap parent;
+    for (auto & a : t_quantified) parent[a] = a;
+    auto find = [&parent](Expr a)
+    {
+      Expr root = a;
+      while (parent[root] != root) root = parent[root];
+      while (parent[a] != root)
+      {
+        Expr next = parent[a];
+        parent[a] = root;
+        a = next;
+      }
+      return root;
+    };
+
+    vector<ExprVector> cnjVars;
+    for (auto & c : cnjs)
+    {
+      ExprFlatSet vars;
+      getConsts (c, vars);
+      ExprVector evars;
+      for (auto & a : vars) if (parent.find(a) != parent.end()) evars.push_back(a);
+      for (int i = 1; i < evars.size(); i++)
+      {
+        Expr r1 = find(evars[0]);
+        Expr r2 = find(evars[i]);
+        if (r1 != r2) parent[r2] = r1;
+      }
+      cnjVars.push_back(evars);
+    }
+
+    map<Expr, ExprSet> clusterCnjs;
+    map<Expr, ExprSet> clusterQuant;
+    ExprSet rest;
+    int i = 0;
+    for (auto & c : cnjs)
+    {
+      if (cnjVars[i].empty()) rest.insert(c);
+      else clusterCnjs[find(cnjVars[i][0])].insert(c);
+      i++;
+    }
+    for (auto & a : t_quantified) clusterQuant[find(a)].insert(a);
+
+    if (clusterCnjs.size() <= 1)
+    {
+      clusters.push_back(t);
+      clusterVars.push_back(t_quantified);
+      return;
+    }
+
+    for (auto & a : clusterCnjs)
+    {
+      ExprSet &cur = a.second;
+      if (clusters.empty()) cur.insert(rest.begin(), rest.end());
+      clusters.push_back(conjoin(cur, t->getFactory()));
+      clusterVars.push_back(clusterQuant[a.first]);
+    }
+
+    // vars that do not appear in T still need a (default) Skolem
+    for (auto & a : clusterQuant)
+      if (clusterCnjs.find(a.first) == clusterCnjs.end())
+        clusterVars[0].insert(a.second.begin(), a.second.end());
+  }
+
+  /**
+   * Split S into at most k disjoint cubes: case-split on Boolean vars of S first,
+   * then bisect numeric vars around model values. Cubes that are empty under S are dropped
+   */
+  inline void getCubes(Expr s, unsigned k, ExprVector& cubes)
+  {
+    ExprFactory &efac = s->getFactory();
+    ExprVector sVars;
+    filter (s, bind::IsConst (), back_inserter (sVars));
+
+    EZ3 z3(efac);
+    ZSolver<EZ3> smt(z3);
+    smt.assertExpr(s);
+    if (!smt.solve()) return;
+
+    ExprVector todo;
+    todo.push_back(mk<TRUE>(efac));
+    while (!todo.empty() && todo.size() + cubes.size() < k)
+    {
+      Expr cube = todo.front();
+      todo.erase(todo.begin());
+
+      smt.push();
+      smt.assertExpr(cube);
+      smt.solve();
+      ZSolver<EZ3>::Model m = smt.getModel();
+      smt.pop();
+
+      Expr lit;
+      for (auto & a : sVars) if (bind::isBoolConst(a) && !contains(cube, a)) { lit = a; break; }
+      if (lit == NULL)
+      {
+        for (auto & a : sVars)
+        {
+          if (contains(cube, a)) continue;
+          Expr val = m.eval(a);
+          if (val == a) continue;
+          lit = mk<LEQ>(a, val);
+          break;
+        }
+      }
+      if (lit == NULL)
+      {
+        cubes.push_back(cube);
+        continue;
+      }
+
+      ExprVector halves;
+      halves.push_back(lit);
+      halves.push_back(mkNeg(lit));
+      for (auto & h : halves)
+      {
+        Expr half = isOpX<TRUE>(cube) ? h : mk<AND>(cube, h);
+        smt.push();
+        smt.assertExpr(half);
+        if (smt.solve()) todo.push_back(half);
+        smt.pop();
+      }
+    }
+    cubes.insert(cubes.end(), todo.begin(), todo.end());
+  }
+
+  /**
+   * Samples of the inputs, for the order of the branches of the Skolem: from
+   * the trace, if given, or else from the solver
+   */
+  inline void sampleSkolemInputs(AeValSolver &ae, bool order, const char *trace)
+  {
+    if (trace != NULL)
+    {
+      if (!ae.readInputs(trace)) outs() << "Unable to read " << trace << "\n";
+    }
+    else if (order) ae.sampleInputs();
+  }
+
+  /**
+   * Solve every cube of S in a separate process, and merge the local Skolems
+   * under an ITE on the cube guards (sound since the cubes partition S).
+   * Returns false if some cube is invalid or could not be solved
+   */
+  inline bool aeSolveInCubes(Expr s, Expr t, ExprSet &t_quantified, ExprVector& cubes,
+                             bool skol, bool compact, bool split, bool gen, bool tree,
+                             bool order, const char *trace, Expr& skolRes, int& iters)
+  {
+    ExprFactory &efac = s->getFactory();
+    vector<pid_t> pids;
+    vector<int> fds;
+
+    outs().flush();
+    for (auto & cube : cubes)
+    {
+      int fd[2];
+      if (pipe(fd) != 0) break;
+      pid_t pid = fork();
+      if (pid < 0)
+      {
+        close(fd[0]);
+        close(fd[1]);
+        break;
+      }
+      if (pid == 0)
+      {
+        close(fd[0]);
+        AeValSolver ae(mk<AND>(s, cube), t, t_quantified, false, skol, gen);
+        string out = "invalid\n";
+        if (!ae.solve())
+        {
+          Expr sk = mk<TRUE>(efac);
+          if (skol)
+          {
+            sampleSkolemInputs(ae, order, trace);
+            sk = ae.getSkolemFunction(compact, tree);
+          }
+          if (skol && split)
+          {
+            ExprSet sepSkols;
+            for (auto & evar : t_quantified)
+              sepSkols.insert(mk<EQ>(evar, ae.getSeparateSkol(evar)));
+            sk = conjoin(sepSkols, efac);
+          }
+          string skBin;
+          if (bin::write(ExprVector(1, sk), skBin))
+            out = "valid " + lexical_cast<string>(ae.getPartitioningSize()) + "\n" + skBin;
+        }
+        for (size_t done = 0; done < out.size(); )
+        {
+          ssize_t n = write(fd[1], out.c_str() + done, out.size() - done);
+          if (n <= 0) break;
+          done += n;
+        }
+        close(fd[1]);
+        _exit(0);
+      }
+      close(fd[1]);
+      pids.push_back(pid);
+      fds.push_back(fd[0]);
+    }
+
+    bool res = (pids.size() == cubes.size());
+    ExprVector skols;
+    for (int i = 0; i < pids.size(); i++)
+    {
+      string out;
+      char buf[4096];
+      ssize_t n;
+      while ((n = read(fds[i], buf, sizeof(buf))) > 0) out.append(buf, n);
+      close(fds[i]);
+      waitpid(pids[i], NULL, 0);
+
+      size_t nl = out.find('\n');
+      if (!res || out.compare(0, 6, "valid ") != 0 || nl == string::npos)
+      {
+        res = false;
+        continue;
+      }
+      ExprVector sk;
+      if (!bin::read(out.data() + nl + 1, out.size() - nl - 1, efac, sk) || sk.size() != 1)
+      {
+        res = false;
+        continue;
+      }
+      iters += lexical_cast<int>(out.substr(6, nl - 6));
+      skols.push_back(sk[0]);
+    }
+    if (!res) return false;
+
+    skolRes = skols.back();
+    for (int i = skols.size() - 2; i >= 0; i--)
+      skolRes = mk<ITE>(cubes[i], skols[i], skolRes);
+    return true;
+  }
+
+  /**
+   * Write the Skolem as C functions (see SkolemToC) over the universals of S and T
+   */
+  inline void emitSkolemC(const char *fname, Expr s, Expr t_orig, ExprSet &t_quantified,
+                          Expr skol, ExprMap &sepSkolMap, bool split)
+  {
+    ExprVector all, universals;
+    filter (mk<AND>(s, t_orig), bind::IsConst (), back_inserter (all));
+    for (auto & a : all)
+      if (t_quantified.count(a) == 0 && find(universals.begin(), universals.end(), a) == universals.end())
+        universals.push_back(a);
+
+    SkolemToC c(universals);
+    ExprMap empt;
+    if (!c.addAll(t_quantified, skol, split ? sepSkolMap : empt))
+    {
+      outs () << "Unable to emit C: " << c.getError() << "\n";
+      return;
+    }
+    ofstream out(fname);
+    c.print(out);
+    if (!out) outs () << "Unable to write " << fname << "\n";
+  }
+
+  inline void serializeSkolem(Expr s, Expr t_orig, ExprSet &t_quantified, Expr skol,
+                              ExprMap &sepSkolMap, bool split, bool debug, const char *emitC = NULL)
+  {
+    if (emitC != NULL) emitSkolemC(emitC, s, t_orig, t_quantified, skol, sepSkolMap, split);
+
+    SMTUtils u(s->getFactory());
+    if (split)
+    {
+      ExprVector sepSkols;
+      for (auto & evar : t_quantified) sepSkols.push_back(mk<EQ>(evar,
+                       simplify(sepSkolMap[evar])));
+      u.serialize_formula(sepSkols);
+      if (debug) outs () << "Sanity check [split]: " <<
+        u.implies(mk<AND>(s, conjoin(sepSkols, s->getFactory())), t_orig) << "\n";
+    }
+    else
+    {
+      outs() << "\nextracted skolem:\n";
+      u.serialize_formula(simplify(skol));
+      if (debug) outs () << "Sanity check: " << u.implies(mk<AND>(s, skol), t_orig) << "\n";
+    }
+  }
+
   /**
    * Simple wrapper
    */
-  inline void aeSolveAndSkolemize(Expr s, Expr t, bool skol, bool debug, bool compact, bool split)
+  inline void aeSolveAndSkolemize(Expr s, Expr t, bool skol, bool debug, bool compact, bool split,
+                                  bool gen = false, unsigned cubes = 1, const char *cacheDir = NULL,
+                                  const char *emitC = NULL, bool tree = false,
+                                  bool order = false, const char *trace = NULL)
   {
     ExprSet t_quantified;
     if (t == NULL)
@@ -1410,8 +2091,8 @@ namespace ufo
       ExprSet s_vars;
       ExprSet t_vars;
 
-      filter (s, bind::IsConst (), inserter (s_vars, s_vars.begin()));
-      filter (t, bind::IsConst (), inserter (t_vars, t_vars.begin()));
+      getConsts (s, s_vars);
+      getConsts (t, t_vars);
 
       t_quantified = minusSets(t_vars, s_vars);
     }
@@ -1422,13 +2103,13 @@ namespace ufo
     Expr t_orig = t;
 
     // formula simplification
-    t = simplifyBool(t);
+    t = simplify(t);
     ExprSet cnjs;
     ExprVector empt;
     getConj(t, cnjs);
     simplBoolReplCnj(empt, cnjs);
     t = conjoin(cnjs, t->getFactory());
-    t = simplifyBool(t);
+    t = simplify(t);
 
     if (debug)
     {
@@ -1439,33 +2120,102 @@ namespace ufo
     }
 
     SMTUtils u(s->getFactory());
-    AeValSolver ae(s, t, t_quantified, debug, skol);
 
-    if (ae.solve()){
-      outs () << "Iter: " << ae.getPartitioningSize() << "; Result: invalid\n";
-      ae.printModelNeg();
+    // an equivalent query might have been solved before
+    std::unique_ptr<AeResultCache> cache;
+    if (cacheDir != NULL) cache.reset(new AeResultCache(cacheDir, s, t, t_quantified, compact, split, tree,
+                                                     order, trace));
+    int cachedIters;
+    Expr cachedSkol;
+    if (cache && cache->lookup(cachedIters, cachedSkol))
+    {
+      ExprMap sepSkolMap;
+      if (split)
+      {
+        ExprSet cnjs;
+        getConj(cachedSkol, cnjs);
+        for (auto & c : cnjs)
+          if (isOpX<EQ>(c) && t_quantified.count(c->left()) > 0) sepSkolMap[c->left()] = c->right();
+      }
+      if ((!split || sepSkolMap.size() == t_quantified.size()) &&
+          u.implies(mk<AND>(s, cachedSkol), t))
+      {
+        if (debug) outs () << "Cache hit\n";
+        outs () << "Iter: " << cachedIters << "; Result: valid\n";
+        if (skol)
+          serializeSkolem(s, t_orig, t_quantified, cachedSkol, sepSkolMap, split, debug, emitC);
+        return;
+      }
+    }
+
+    // independent existential clusters are solved separately, and their Skolems are conjoined
+    ExprVector clusters;
+    vector<ExprSet> clusterVars;
+    getExistentialClusters(t, t_quantified, clusters, clusterVars);
+    if (debug && clusters.size() > 1) outs () << "Clusters: " << clusters.size() << "\n";
+
+    ExprVector cbs;
+    if (cubes > 1) getCubes(s, cubes, cbs);
+    if (debug && cbs.size() > 1) outs () << "Cubes: " << cbs.size() << "\n";
+
+    int iters = 0;
+    ExprSet skols;
+    ExprMap sepSkolMap;
+    ExprSet subsets;
+    std::unique_ptr<AeValSolver> cex;
+    for (int i = 0; i < clusters.size(); i++)
+    {
+      // cube-and-conquer: fall back to the sequential engine if some cube is invalid
+      Expr cubesSkol;
+      if (cbs.size() > 1 && aeSolveInCubes(s, clusters[i], clusterVars[i], cbs,
+                                           skol, compact, split, gen, tree, order, trace,
+                                           cubesSkol, iters))
+      {
+        skols.insert(cubesSkol);
+        if (skol && split)
+          for (auto & evar : clusterVars[i]) sepSkolMap[evar] = projectITE(cubesSkol, evar);
+        continue;
+      }
+      if (debug && cbs.size() > 1) outs () << "Some cube is invalid; solving sequentially\n";
+
+      std::unique_ptr<AeValSolver> ae (new AeValSolver(s, clusters[i], clusterVars[i], debug, skol, gen));
+      bool res = ae->solve();
+      iters += ae->getPartitioningSize();
+      if (res)
+      {
+        subsets.insert(ae->getValidSubset(compact));
+        if (!cex) cex = std::move(ae);
+      }
+      else if (skol && !cex)
+      {
+        sampleSkolemInputs(*ae, order, trace);
+        skols.insert(ae->getSkolemFunction(compact, tree));
+        if (split)
+          for (auto & evar : clusterVars[i]) sepSkolMap[evar] = ae->getSeparateSkol(evar);
+      }
+    }
+
+    if (cex){
+      outs () << "Iter: " << iters << "; Result: invalid\n";
+      cex->printModelNeg();
       outs() << "\nvalid subset:\n";
-      u.serialize_formula(simplifyBool(simplifyArithm(ae.getValidSubset(compact))));
+      u.serialize_formula(simplify(conjoin(subsets, s->getFactory())));
     } else {
-      outs () << "Iter: " << ae.getPartitioningSize() << "; Result: valid\n";
+      outs () << "Iter: " << iters << "; Result: valid\n";
       if (skol)
+        serializeSkolem(s, t_orig, t_quantified, conjoin(skols, s->getFactory()), sepSkolMap, split,
+                        debug, emitC);
+
+      if (cache && skol)
       {
-        Expr skol = ae.getSkolemFunction(compact);
+        Expr sk = conjoin(skols, s->getFactory());
         if (split)
         {
-          ExprVector sepSkols;
-          for (auto & evar : t_quantified) sepSkols.push_back(mk<EQ>(evar,
-                           simplifyBool(simplifyArithm(ae.getSeparateSkol(evar)))));
-          u.serialize_formula(sepSkols);
-          if (debug) outs () << "Sanity check [split]: " <<
-            u.implies(mk<AND>(s, conjoin(sepSkols, s->getFactory())), t_orig) << "\n";
-        }
-        else
-        {
-          outs() << "\nextracted skolem:\n";
-          u.serialize_formula(simplifyBool(simplifyArithm(skol)));
-          if (debug) outs () << "Sanity check: " << u.implies(mk<AND>(s, skol), t_orig) << "\n";
+          ExprSet sepSkols;
+          for (auto & evar : t_quantified) sepSkols.insert(mk<EQ>(evar, sepSkolMap[evar]));
+          sk = conjoin(sepSkols, s->getFactory());
         }
+        cache->store(iters, sk);
       }
     }
   }
@@ -1476,8 +2226,8 @@ namespace ufo
     ExprSet s_vars;
     ExprSet t_vars;
 
-    filter (s, bind::IsConst (), inserter (s_vars, s_vars.begin()));
-    filter (t, bind::IsConst (), inserter (t_vars, t_vars.begin()));
+    getConsts (s, s_vars);
+    getConsts (t, t_vars);
 
     ExprSet t_quantified = minusSets(t_vars, s_vars);
 
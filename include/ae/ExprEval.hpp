@@ -0,0 +1,459 @@
+#ifndef EXPREVAL__HPP__
+#define EXPREVAL__HPP__
+#include <assert.h>
+#include <unordered_map>
+
+#include "ufo/Expr.hpp"
+#include "ufo/Smt/EZ3.hh"
+
+using namespace std;
+using namespace boost;
+namespace ufo
+{
+  /**
+   * Value of a term under a concrete assignment: a Boolean, a rational
+   * (for both Int and Real terms), or unknown
+   */
+  struct EvalVal
+  {
+    enum Kind { UNKNOWN, BOOL, NUM };
+
+    Kind kind;
+    bool b;
+    mpq_class q;
+
+    EvalVal () : kind (UNKNOWN), b (false) {}
+    static EvalVal mkBool (bool b) { EvalVal v; v.kind = BOOL; v.b = b; return v; }
+    static EvalVal mkNum (const mpq_class &q) { EvalVal v; v.kind = NUM; v.q = q; return v; }
+
+    bool isBool () const { return kind == BOOL; }
+    bool isNum () const { return kind == NUM; }
+
+    boost::tribool toBool () const
+    {
+      if (!isBool ()) return boost::logic::indeterminate;
+      return b;
+    }
+  };
+
+  /**
+   * Parse an integer, a fraction or a decimal (e.g., -3, 1/2, 0.25)
+   */
+  inline bool parseNumeral (const string &str, mpq_class &q)
+  {
+    size_t dot = str.find ('.');
+    if (dot == string::npos)
+    {
+      if (q.set_str (str, 10) != 0 || q.get_den () == 0) return false;
+      q.canonicalize ();
+      return true;
+    }
+    string frac = str.substr (dot + 1);
+    if (frac.find_first_not_of ("0123456789") != string::npos) return false;
+    mpz_class num, den;
+    if (num.set_str (str.substr (0, dot) + frac, 10) != 0) return false;
+    mpz_ui_pow_ui (den.get_mpz_t (), 10, frac.size ());
+    q = mpq_class (num, den);
+    q.canonicalize ();
+    return true;
+  }
+
+  /**
+   * Concrete assignment of constants
+   */
+  class ConcreteModel
+  {
+    ExprVector vars;      // keeps the keys of vals alive
+    unordered_map<ENode*, EvalVal> vals;
+
+  public:
+
+    void set (Expr var, const EvalVal &val)
+    {
+      if (vals.count (&*var) == 0) vars.push_back (var);
+      vals[&*var] = val;
+    }
+
+    const EvalVal *get (ENode *var) const
+    {
+      auto it = vals.find (var);
+      return it == vals.end () ? NULL : &it->second;
+    }
+
+    /** whether all constants of e are assigned */
+    bool covers (Expr e) const
+    {
+      for (ENode *c : constsOf (e)) if (vals.count (c) == 0) return false;
+      return true;
+    }
+
+    size_t size () const { return vals.size (); }
+  };
+
+  /**
+   * Semantics of the supported operators, shared by the interpreter and
+   * by compiled programs. Anything that can not be decided exactly is unknown
+   */
+  struct EvalOps
+  {
+    enum Code { OP_OTHER, OP_LIT, OP_VAR,
+                OP_AND, OP_OR, OP_NEG, OP_IMPL, OP_IFF, OP_XOR, OP_ITE,
+                OP_EQ, OP_NEQ, OP_LEQ, OP_GEQ, OP_LT, OP_GT,
+                OP_PLUS, OP_MINUS, OP_MULT, OP_DIV, OP_MOD, OP_ABS };
+
+    /** the code of the top operator of e; the value of literals goes to lit */
+    static Code classify (Expr e, EvalVal &lit)
+    {
+      if (isOpX<TRUE>(e)) { lit = EvalVal::mkBool (true); return OP_LIT; }
+      if (isOpX<FALSE>(e)) { lit = EvalVal::mkBool (false); return OP_LIT; }
+      if (isOpX<MPZ>(e)) { lit = EvalVal::mkNum (mpq_class (getTermRef<mpz_class> (e))); return OP_LIT; }
+      if (isOpX<MPQ>(e)) { lit = EvalVal::mkNum (getTermRef<mpq_class> (e)); return OP_LIT; }
+      if (isOpX<INT>(e)) { lit = EvalVal::mkNum (mpq_class (getTerm<int> (e))); return OP_LIT; }
+      if (bind::IsConst () (e)) return OP_VAR;
+
+      if (isOpX<AND>(e)) return OP_AND;
+      if (isOpX<OR>(e)) return OP_OR;
+      if (isOpX<NEG>(e)) return e->arity () == 1 ? OP_NEG : OP_OTHER;
+      if (isOpX<IMPL>(e)) return e->arity () == 2 ? OP_IMPL : OP_OTHER;
+      if (isOpX<IFF>(e)) return e->arity () == 2 ? OP_IFF : OP_OTHER;
+      if (isOpX<XOR>(e)) return e->arity () == 2 ? OP_XOR : OP_OTHER;
+      if (isOpX<ITE>(e)) return e->arity () == 3 ? OP_ITE : OP_OTHER;
+
+      if (isOp<ComparissonOp>(e))
+      {
+        if (e->arity () != 2) return OP_OTHER;
+        if (isOpX<EQ>(e)) return OP_EQ;
+        if (isOpX<NEQ>(e)) return OP_NEQ;
+        if (isOpX<LEQ>(e)) return OP_LEQ;
+        if (isOpX<GEQ>(e)) return OP_GEQ;
+        if (isOpX<LT>(e)) return OP_LT;
+        return OP_GT;
+      }
+
+      if (isOpX<PLUS>(e)) return OP_PLUS;
+      if (isOpX<MINUS>(e) || isOpX<UN_MINUS>(e)) return e->arity () > 0 ? OP_MINUS : OP_OTHER;
+      if (isOpX<MULT>(e)) return OP_MULT;
+      if (isOpX<DIV>(e) || isOpX<IDIV>(e)) return e->arity () == 2 ? OP_DIV : OP_OTHER;
+      if (isOpX<MOD>(e)) return e->arity () == 2 ? OP_MOD : OP_OTHER;
+      if (isOpX<ABS>(e)) return e->arity () == 1 ? OP_ABS : OP_OTHER;
+      return OP_OTHER;
+    }
+
+    /**
+     * Applies an operator (not OP_LIT, OP_VAR or OP_OTHER) to n arguments,
+     * arg(i) being the value of the i-th one
+     */
+    template <typename Arg>
+    static EvalVal apply (Code c, unsigned n, Arg arg)
+    {
+      switch (c)
+      {
+      case OP_AND:
+      case OP_OR:
+      {
+        // -- a false (true) argument decides even if others are unknown
+        bool isAnd = (c == OP_AND), unknown = false;
+        for (unsigned i = 0; i < n; i++)
+        {
+          const EvalVal &a = arg (i);
+          if (!a.isBool ()) unknown = true;
+          else if (a.b != isAnd) return a;
+        }
+        return unknown ? EvalVal () : EvalVal::mkBool (isAnd);
+      }
+      case OP_NEG:
+        return arg (0).isBool () ? EvalVal::mkBool (!arg (0).b) : EvalVal ();
+      case OP_IMPL:
+      case OP_IFF:
+      case OP_XOR:
+      {
+        const EvalVal &l = arg (0);
+        const EvalVal &r = arg (1);
+        if (c == OP_IMPL && ((l.isBool () && !l.b) || (r.isBool () && r.b)))
+          return EvalVal::mkBool (true);
+        if (!l.isBool () || !r.isBool ()) return EvalVal ();
+        if (c == OP_IMPL) return EvalVal::mkBool (false);
+        return EvalVal::mkBool (c == OP_IFF ? l.b == r.b : l.b != r.b);
+      }
+      case OP_ITE:
+        if (!arg (0).isBool ()) return EvalVal ();
+        return arg (arg (0).b ? 1 : 2);
+      case OP_EQ: case OP_NEQ: case OP_LEQ: case OP_GEQ: case OP_LT: case OP_GT:
+      {
+        const EvalVal &l = arg (0);
+        const EvalVal &r = arg (1);
+        if (l.kind != r.kind || l.kind == EvalVal::UNKNOWN) return EvalVal ();
+        if (l.isBool ())
+        {
+          if (c == OP_EQ) return EvalVal::mkBool (l.b == r.b);
+          if (c == OP_NEQ) return EvalVal::mkBool (l.b != r.b);
+          return EvalVal ();
+        }
+        int d = cmp (l.q, r.q);
+        switch (c)
+        {
+        case OP_EQ: return EvalVal::mkBool (d == 0);
+        case OP_NEQ: return EvalVal::mkBool (d != 0);
+        case OP_LEQ: return EvalVal::mkBool (d <= 0);
+        case OP_GEQ: return EvalVal::mkBool (d >= 0);
+        case OP_LT: return EvalVal::mkBool (d < 0);
+        default: return EvalVal::mkBool (d > 0);
+        }
+      }
+      default:
+        break;
+      }
+
+      // -- arithmetic
+      for (unsigned i = 0; i < n; i++) if (!arg (i).isNum ()) return EvalVal ();
+      switch (c)
+      {
+      case OP_PLUS:
+      {
+        mpq_class r (0);
+        for (unsigned i = 0; i < n; i++) r += arg (i).q;
+        return EvalVal::mkNum (r);
+      }
+      case OP_MINUS:
+      {
+        if (n == 1) return EvalVal::mkNum (-arg (0).q);
+        mpq_class r (arg (0).q);
+        for (unsigned i = 1; i < n; i++) r -= arg (i).q;
+        return EvalVal::mkNum (r);
+      }
+      case OP_MULT:
+      {
+        mpq_class r (1);
+        for (unsigned i = 0; i < n; i++) r *= arg (i).q;
+        return EvalVal::mkNum (r);
+      }
+      case OP_DIV:
+      {
+        // -- DIV and IDIV are marshaled to the same division of Z3, which
+        // -- depends on the sort; sorts are not known here, so an inexact
+        // -- quotient of integral values is unknown
+        const mpq_class &x = arg (0).q;
+        const mpq_class &y = arg (1).q;
+        if (y == 0) return EvalVal ();
+        mpq_class r (x / y);
+        if (r.get_den () != 1 && x.get_den () == 1 && y.get_den () == 1) return EvalVal ();
+        return EvalVal::mkNum (r);
+      }
+      case OP_MOD:
+      {
+        // -- as in SMT-LIB: the remainder is non-negative
+        const mpq_class &x = arg (0).q;
+        const mpq_class &y = arg (1).q;
+        if (x.get_den () != 1 || y.get_den () != 1 || y == 0) return EvalVal ();
+        mpz_class r;
+        mpz_fdiv_r (r.get_mpz_t (), x.get_num_mpz_t (), y.get_num_mpz_t ());
+        if (r < 0) r -= y.get_num ();      // -- only when y < 0
+        return EvalVal::mkNum (mpq_class (r));
+      }
+      case OP_ABS:
+        return EvalVal::mkNum (abs (arg (0).q));
+      default:
+        return EvalVal ();
+      }
+    }
+  };
+
+  /**
+   * Interpreter of Bool/LIA/LRA terms under a ConcreteModel, memoized over
+   * the DAG (also across calls). Terms must stay alive while it is used
+   */
+  class ExprEvaluator
+  {
+    const ConcreteModel &m;
+    unordered_map<ENode*, EvalVal> memo;
+
+    EvalVal evalNode (Expr e)
+    {
+      EvalVal lit;
+      EvalOps::Code c = EvalOps::classify (e, lit);
+      switch (c)
+      {
+      case EvalOps::OP_LIT:
+        return lit;
+      case EvalOps::OP_VAR:
+      {
+        const EvalVal *v = m.get (&*e);
+        return v == NULL ? EvalVal () : *v;
+      }
+      case EvalOps::OP_OTHER:
+        return EvalVal ();
+      case EvalOps::OP_AND:
+      case EvalOps::OP_OR:
+      {
+        // -- stop at the first deciding argument
+        bool unknown = false;
+        for (auto it = e->args_begin (), end = e->args_end (); it != end; ++it)
+        {
+          EvalVal a = eval (*it);
+          if (!a.isBool ()) unknown = true;
+          else if (a.b != (c == EvalOps::OP_AND)) return a;
+        }
+        return unknown ? EvalVal () : EvalVal::mkBool (c == EvalOps::OP_AND);
+      }
+      case EvalOps::OP_ITE:
+      {
+        EvalVal cond = eval (e->arg (0));
+        if (!cond.isBool ()) return EvalVal ();
+        return eval (e->arg (cond.b ? 1 : 2));
+      }
+      default:
+      {
+        vector<EvalVal> args;
+        args.reserve (e->arity ());
+        for (auto it = e->args_begin (), end = e->args_end (); it != end; ++it)
+          args.push_back (eval (*it));
+        return EvalOps::apply (c, args.size (),
+                               [&args] (unsigned i) -> const EvalVal& { return args[i]; });
+      }
+      }
+    }
+
+  public:
+
+    ExprEvaluator (const ConcreteModel &_m) : m(_m) {}
+
+    EvalVal eval (Expr e)
+    {
+      auto it = memo.find (&*e);
+      if (it != memo.end ()) return it->second;
+      EvalVal res = evalNode (e);
+      memo[&*e] = res;
+      return res;
+    }
+
+    /** truth value of a formula, indeterminate if unknown */
+    boost::tribool evalBool (Expr e) { return eval (e).toBool (); }
+  };
+
+  /**
+   * A term compiled once for evaluation under many assignments: a postfix
+   * program over the DAG, where each shared subterm is one instruction whose
+   * result is kept in a register
+   */
+  class EvalProgram
+  {
+    struct Instr
+    {
+      EvalOps::Code code;
+      unsigned first;     // arguments are the registers args [first, first + n)
+      unsigned n;
+      ENode *var;         // for OP_VAR
+      EvalVal lit;        // for OP_LIT
+    };
+
+    Expr root;            // keeps the constants of the program alive
+    vector<Instr> prog;
+    vector<unsigned> args;
+
+  public:
+
+    EvalProgram (Expr e) : root (e)
+    {
+      unordered_map<ENode*, unsigned> reg;
+      // -- iterative post-order
+      vector<pair<ENode*, bool> > stack;
+      stack.push_back (make_pair (&*e, false));
+      while (!stack.empty ())
+      {
+        ENode *n = stack.back ().first;
+        bool kidsDone = stack.back ().second;
+        stack.pop_back ();
+        if (reg.count (n) > 0) continue;
+
+        Instr in;
+        in.code = EvalOps::classify (n, in.lit);
+        in.var = (in.code == EvalOps::OP_VAR) ? n : NULL;
+        in.first = args.size ();
+        in.n = 0;
+
+        bool leaf = (in.code == EvalOps::OP_LIT || in.code == EvalOps::OP_VAR ||
+                     in.code == EvalOps::OP_OTHER);
+        if (!leaf && !kidsDone)
+        {
+          stack.push_back (make_pair (n, true));
+          for (size_t i = n->arity (); i > 0; i--)
+            if (reg.count (n->arg (i - 1)) == 0)
+              stack.push_back (make_pair (n->arg (i - 1), false));
+          continue;
+        }
+
+        if (!leaf)
+        {
+          for (auto it = n->args_begin (), end = n->args_end (); it != end; ++it)
+            args.push_back (reg [*it]);
+          in.n = n->arity ();
+        }
+        reg [n] = prog.size ();
+        prog.push_back (in);
+      }
+    }
+
+    size_t size () const { return prog.size (); }
+
+    /** value of the term under m */
+    EvalVal run (const ConcreteModel &m) const
+    {
+      vector<EvalVal> regs (prog.size ());
+      for (size_t i = 0; i < prog.size (); i++)
+      {
+        const Instr &in = prog[i];
+        switch (in.code)
+        {
+        case EvalOps::OP_LIT:
+          regs[i] = in.lit;
+          break;
+        case EvalOps::OP_VAR:
+        {
+          const EvalVal *v = m.get (in.var);
+          if (v != NULL) regs[i] = *v;
+          break;
+        }
+        case EvalOps::OP_OTHER:
+          break;
+        default:
+        {
+          const unsigned *a = &args[in.first];
+          regs[i] = EvalOps::apply (in.code, in.n,
+                                    [&regs, a] (unsigned j) -> const EvalVal& { return regs[a[j]]; });
+        }
+        }
+      }
+      return regs.back ();
+    }
+
+    boost::tribool runBool (const ConcreteModel &m) const { return run (m).toBool (); }
+
+    /** truth values of the term under each model of a range */
+    template <typename Range>
+    vector<boost::tribool> runAll (const Range &models) const
+    {
+      vector<boost::tribool> res;
+      for (auto &m : models) res.push_back (runBool (m));
+      return res;
+    }
+  };
+
+  /**
+   * Reads the values of vars in a model of Z3 (with model completion);
+   * constants whose value is not a numeral or a Boolean are left out
+   */
+  template <typename Range>
+  void getConcreteModel (ZSolver<EZ3>::Model &m, const Range &vars, ConcreteModel &res)
+  {
+    ConcreteModel empty;
+    for (auto & v : vars)
+    {
+      if (!bind::isBoolConst (v) && !bind::isIntConst (v) && !bind::isRealConst (v)) continue;
+      Expr val = m.eval (v, true);
+      EvalVal ev = ExprEvaluator (empty).eval (val);
+      if (ev.kind != EvalVal::UNKNOWN) res.set (v, ev);
+    }
+  }
+}
+
+#endif
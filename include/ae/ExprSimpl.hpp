@@ -3,6 +3,7 @@
 #include <assert.h>
 
 #include "ufo/Smt/EZ3.hh"
+#include "ae/LinearForm.hpp"
 
 using namespace std;
 using namespace boost;
@@ -25,14 +26,14 @@ namespace ufo
 
   template<typename Range> static Expr mkplus(Range& terms, ExprFactory &efac){
     return
-      (terms.size() == 0) ? mkTerm (mpz_class (0), efac) :
+      (terms.size() == 0) ? efac.mkZero() :
       (terms.size() == 1) ? *terms.begin() :
       mknary<PLUS>(terms);
   }
 
   template<typename Range> static Expr mkmult(Range& terms, ExprFactory &efac){
     return
-      (terms.size() == 0) ? mkTerm (mpz_class (1), efac) :
+      (terms.size() == 0) ? efac.mkOne() :
       (terms.size() == 1) ? *terms.begin() :
       mknary<MULT>(terms);
   }
@@ -45,35 +46,37 @@ namespace ufo
   }
 
   template<typename Range> static bool emptyIntersect(Expr a, Range& bv){
-    ExprVector av;
-    filter (a, bind::IsConst (), inserter(av, av.begin()));
-    return emptyIntersect(av, bv);
+    for (auto &var: bv) if (hasConst(a, var)) return false;
+    return true;
   }
 
   inline static bool emptyIntersect(Expr a, Expr b){
-    ExprVector bv;
-    filter (b, bind::IsConst (), inserter(bv, bv.begin()));
-    return emptyIntersect(a, bv);
+    auto &av = constsOf(a);
+    auto &bv = constsOf(b);
+    auto it = av.begin();
+    auto jt = bv.begin();
+    std::less<ENode*> lessId;
+    while (it != av.end() && jt != bv.end())
+    {
+      if (*it == *jt) return false;
+      if (lessId(*it, *jt)) ++it; else ++jt;
+    }
+    return true;
   }
 
   template<typename Range> static int intersectSize(Expr a, Range& bv){
-    ExprVector av;
-    filter (a, bind::IsConst (), inserter(av, av.begin()));
     ExprSet intersect;
-    for (auto &var1: av){
-      for (auto &var2: bv)
-        if (var1 == var2) intersect.insert(var1);
-    }
+    for (auto &var: bv) if (hasConst(a, var)) intersect.insert(var);
     return intersect.size();
   }
 
   inline static Expr multVar(Expr var, int coef){
     if (coef == 0)
-      return mkTerm (mpz_class (0), var->getFactory());
+      return var->getFactory().mkZero();
     if (isOpX<MPZ>(var)) return
-      mkTerm (mpz_class (lexical_cast<int>(var) * coef), var->getFactory());
+      mkTerm (mpz_class (getTermRef<mpz_class>(var) * coef), var->getFactory());
     if (isOpX<MPQ>(var)) return
-      mkTerm (mpq_class (lexical_cast<int>(var) * coef), var->getFactory());
+      mkTerm (mpq_class (getTermRef<mpq_class>(var) * coef), var->getFactory());
 
     return mk<MULT>(mkTerm (mpz_class (coef), var->getFactory()), var);
   }
@@ -81,10 +84,9 @@ namespace ufo
   inline static int isMultVar(Expr e, Expr var){
     if (e == var) return 1;
     if (!isOpX<MULT>(e)) return 0;
-    if (isOpX<MPZ>(e->right()) && var == e->left()) return lexical_cast<int>(e->right());
-    if (isOpX<MPZ>(e->left()) && var == e->right()) return lexical_cast<int>(e->left());
-    if (isOpX<MPQ>(e->right()) && var == e->left()) return lexical_cast<int>(e->right());
-    if (isOpX<MPQ>(e->left()) && var == e->right()) return lexical_cast<int>(e->left());
+    long c;
+    if (var == e->left() && getSmallNum(e->right(), c) && c == (int)c) return c;
+    if (var == e->right() && getSmallNum(e->left(), c) && c == (int)c) return c;
     return 0;
   }
 
@@ -96,7 +98,7 @@ namespace ufo
       return true;
     }
     if (isOpX<MULT>(e)){
-      if (lexical_cast<string>(e->left()) == "-1" && e->right() == var){
+      if (isNumEq(e->left(), -1) && e->right() == var){
         return true;
       }
     }
@@ -111,23 +113,13 @@ namespace ufo
       return e->left();
     }
     else if (isOpX<MPQ>(e)){
-      string val = lexical_cast<string>(e);
-      int delim = val.find("/");
-      int val1 = stoi(val.substr(0, delim));
-      int val2 = stoi(val.substr(delim + 1));
-      if (delim < 0) {
-        return mkTerm (mpq_class (-val1), e->getFactory());
-      } else {
-        string inv_val = to_string(-val1) + "/" + to_string(val2);
-        return mkTerm (mpq_class (inv_val), e->getFactory());
-      }
+      return mkTerm (mpq_class (-getTermRef<mpq_class>(e)), e->getFactory());
     }
     else if (isOpX<MPZ>(e)){
-      int val = lexical_cast<int>(e);
-      return mkTerm (mpz_class (-val), e->getFactory());
+      return mkTerm (mpz_class (-getTermRef<mpz_class>(e)), e->getFactory());
     }
     else if (isOpX<MULT>(e)){
-      if (lexical_cast<string>(e->left()) == "-1"){
+      if (isNumEq(e->left(), -1)){
         return e->right();
       } else if (e->arity() == 2) {
         Expr c = additiveInverse(e->left());
@@ -264,6 +256,12 @@ namespace ufo
             isOp<ComparissonOp>(a) || bind::isBoolConst(a));
   }
 
+  /** comparisons and Boolean constants (e.g., for filter) */
+  struct IsLiteral : public std::unary_function<Expr, bool>
+  {
+    bool operator() (Expr a) { return isOp<ComparissonOp>(a) || bind::isBoolConst(a); }
+  };
+
   /**
    * Represent Expr as multiplication
    */
@@ -271,7 +269,7 @@ namespace ufo
     if (isOpX<MULT>(e)){
       return e;
     } else {
-      return mk<MULT>(mkTerm (mpz_class (1), e->getFactory()), e);
+      return mk<MULT>(e->getFactory().mkOne(), e);
     }
   }
 
@@ -279,7 +277,7 @@ namespace ufo
    * Represent Zero as multiplication
    */
   inline static Expr multZero(Expr e, Expr multiplier){
-    if (lexical_cast<string>(e) == "0")
+    if (isNumEq(e, 0))
       return mk<MULT>(multiplier, e);
     else return e;
   }
@@ -315,10 +313,13 @@ namespace ufo
   }
 
   /**
-   * Commutativity in Addition
+   * Commutativity in Addition (linear terms are brought to the form of LinearForm)
    */
   inline static Expr exprSorted(Expr e){
-    Expr res = e;
+    Expr res = sortedSum(e);
+    if (res != NULL) return res;
+
+    res = e;
     if (isOpX<PLUS>(e)) {
       ExprSet expClauses;
       for (auto it = e->args_begin(), end = e->args_end(); it != end; ++it){
@@ -328,7 +329,7 @@ namespace ufo
     }
 
     if (isOpX<MULT>(e)) {
-      if (lexical_cast<string>(e->left())  == "-1"){
+      if (isNumEq(e->left(), -1)){
         Expr l = e->right();
 
         if (isOpX<PLUS>(l)) {
@@ -351,7 +352,7 @@ namespace ufo
     assert(e->arity() == 2);
     if (!isOpX<UN_MINUS>(e->left()) &&
         !(isOpX<MULT>(e->left()) &&
-          lexical_cast<string>(e->left()->left()) == "-1") ) return e;
+          isNumEq(e->left()->left(), -1)) ) return e;
 
     return mk<T>(additiveInverse(e->left()), additiveInverse(exprDistributor(e->right())));
   }
@@ -428,7 +429,7 @@ namespace ufo
             if (e->left() == e2->left()){
               Expr e1r = exprSorted(e->right());
               Expr e2r = exprSorted(e2->right());
-              if ( e1r == e2r ){
+              if ( e1r == e2r || sameLinear(e->right(), e2->right()) ){
                 if (clean){
                   expClauses.erase(e);
                   expClauses.erase(e2);
@@ -474,10 +475,10 @@ namespace ufo
       if (isOpX<T>(e)){
         for (auto &e2: expClauses){
           if (isOpX<T>(e2)){
-            if (e->right() == e2->right() && e2->right() == mkTerm (mpz_class (0), e2->getFactory())){
+            if (e->right() == e2->right() && e2->right() == e2->getFactory().mkZero()){
               Expr l1 = exprSorted(additiveInverse(e->left()));
               Expr l2 = exprSorted(e2->left());
-              if (l1 == l2){
+              if (l1 == l2 || sameLinear(l1, l2)){
                 if (clean){
                   expClauses.erase(e);
                   expClauses.erase(e2);
@@ -542,8 +543,14 @@ namespace ufo
    *  (a <= b + .. + (-1)*var + .. + c) -> (var <= (-1)*a + b + .. + c)
    *
    *  same for >=
+   *
+   *  Linear comparisons are handled by isolateVar (i.e., var gets the coefficient
+   *  1, or k > 0 for integers); the rules above are only the fallback
    */
   inline static Expr ineqMover(Expr e, Expr var){
+      Expr iso = isolateVar(e, var, bind::isIntConst(var));
+      if (iso != NULL) return iso;
+
       if (isOpX<LEQ>(e)){
         return rewriteHelperM<LEQ>(e, var);
       } else if (isOpX<GEQ>(e)){
@@ -584,7 +591,7 @@ namespace ufo
    */
   inline static Expr eqDiffMover(Expr e){
     if(isOpX<EQ>(e)){
-      if (isOpX<MINUS>(e->left()) && e->left()->arity() == 2 && lexical_cast<string>(e->right()) == "0"){
+      if (isOpX<MINUS>(e->left()) && e->left()->arity() == 2 && isNumEq(e->right(), 0)){
         return mk<EQ>(e->left()->left(), e->left()->right());
       }
     }
@@ -692,7 +699,7 @@ namespace ufo
     Expr ret = mk<MINUS>(a, b);
 
     if (a == b) {
-      ret = mkTerm (mpz_class (0), a->getFactory());
+      ret = a->getFactory().mkZero();
     } else
 
       if (isOpX<PLUS>(a)){
@@ -713,22 +720,22 @@ namespace ufo
             } else
               
               if (isOpX<UN_MINUS>(b)) {
-                if (b->left() == mkTerm (mpz_class (0), a->getFactory())) {
+                if (b->left() == a->getFactory().mkZero()) {
                   ret = a;
                 } else {
                   ret = mk<PLUS>(a,b->left());
                 }
               } else
                 
-                if (mkTerm (mpz_class (-1), a->getFactory()) == b) {
-                  ret = mk<PLUS>(a, mkTerm (mpz_class (1), a->getFactory()));
+                if (a->getFactory().mkMinusOne() == b) {
+                  ret = mk<PLUS>(a, a->getFactory().mkOne());
                 } else
                   
-                  if (b == mkTerm (mpz_class (0), a->getFactory())) {
+                  if (b == a->getFactory().mkZero()) {
                     ret = a;
                   } else
                     
-                    if (a == mkTerm (mpz_class (0), a->getFactory())){
+                    if (a == a->getFactory().mkZero()){
                       if (isOpX<UN_MINUS>(b)){
                         ret = b->left();
                       }
@@ -765,8 +772,8 @@ namespace ufo
   {
     if (!isOpX<MPZ>(term->left()) || !isOpX<MPZ>(term->right()))
       return false;
-    int a = lexical_cast<int>(term->left());
-    int b = lexical_cast<int>(term->right());
+    const mpz_class &a = getTermRef<mpz_class>(term->left());
+    const mpz_class &b = getTermRef<mpz_class>(term->right());
     if (isOpX<EQ>(term))
     {
       return (a == b);
@@ -791,14 +798,14 @@ namespace ufo
     return (a > b);
   }
 
-  inline static int separateConst(ExprVector& plsOps)
+  inline static mpz_class separateConst(ExprVector& plsOps)
   {
-    int c = 0;
+    mpz_class c = 0;
     for (auto it = plsOps.begin(); it != plsOps.end(); )
     {
       if (isOpX<MPZ>(*it))
       {
-        c += lexical_cast<int>(*it);
+        c += getTermRef<mpz_class>(*it);
         it = plsOps.erase(it);
         continue;
       }
@@ -811,8 +818,8 @@ namespace ufo
     ExprVector plsOps;
     getPlusTerms (exp, plsOps);
     // GF: to extend
-    int c = separateConst(plsOps);
-    if (c != 0) plsOps.push_back(mkTerm (mpz_class (c), exp->getFactory()));
+    mpz_class c = separateConst(plsOps);
+    if (c != 0) plsOps.push_back(mkTerm (c, exp->getFactory()));
     return mkplus(plsOps, exp->getFactory());
   }
 
@@ -832,7 +839,7 @@ namespace ufo
       {
         if (*it1 == *it2)
         {
-          if (lexical_cast<string>(*it1) != "0")
+          if (!isNumEq(*it1, 0))
             commonTerms.push_back(*it1);
           found = true;
           plusOpsRight.erase(it2);
@@ -851,7 +858,7 @@ namespace ufo
     Expr b2 = mkplus(plusOpsRight, efac);
     if (b1 == b2)
     {
-      if (lexical_cast<string>(b1) != "0")
+      if (!isNumEq(b1, 0))
         commonTerms.push_back(b1);
     }
     else
@@ -871,8 +878,8 @@ namespace ufo
     getPlusTerms(exp->left(), plusOpsLeft);
     getPlusTerms(exp->right(), plusOpsRight);
 
-    int c1 = separateConst(plusOpsLeft);
-    int c2 = separateConst(plusOpsRight);
+    mpz_class c1 = separateConst(plusOpsLeft);
+    mpz_class c2 = separateConst(plusOpsRight);
 
     for (auto it1 = plusOpsLeft.begin(); it1 != plusOpsLeft.end(); )
     {
@@ -913,9 +920,9 @@ namespace ufo
     SimplifyArithmExpr (ExprFactory& _efac):
     efac(_efac)
     {
-      zero = mkTerm (mpz_class (0), efac);
-      one = mkTerm (mpz_class (1), efac);
-      minus_one = mkTerm (mpz_class (-1), efac);
+      zero = efac.mkZero();
+      one = efac.mkOne();
+      minus_one = efac.mkMinusOne();
     };
 
     Expr operator() (Expr exp)
@@ -977,8 +984,9 @@ namespace ufo
   struct SimplifyBoolExpr
   {
     ExprFactory &efac;
+    bool deep; // re-simplify operands of AND/OR (not needed if driven to a fixpoint)
 
-    SimplifyBoolExpr (ExprFactory& _efac) : efac(_efac){};
+    SimplifyBoolExpr (ExprFactory& _efac, bool _deep = true) : efac(_efac), deep(_deep){};
 
     Expr operator() (Expr exp)
     {
@@ -1018,7 +1026,7 @@ namespace ufo
           {
             continue;
           }
-          newDsjs.insert(simplifyBool(a));
+          newDsjs.insert(deep ? simplifyBool(a) : a);
         }
         return disjoin (newDsjs, efac);
       }
@@ -1037,7 +1045,7 @@ namespace ufo
           {
             continue;
           }
-          newCnjs.insert(simplifyBool(a));
+          newCnjs.insert(deep ? simplifyBool(a) : a);
         }
         return conjoin (newCnjs, efac);
       }
@@ -1077,46 +1085,173 @@ namespace ufo
 
   inline static Expr simplifyArithm (Expr exp)
   {
-    RW<SimplifyArithmExpr> rw(new SimplifyArithmExpr(exp->getFactory()));
-    return dagVisit (rw, exp);
+    return rewritePure (std::make_shared<SimplifyArithmExpr>(exp->getFactory()), exp);
   }
 
   inline static Expr simplifyBool (Expr exp)
   {
-    RW<SimplifyBoolExpr> rw(new SimplifyBoolExpr(exp->getFactory()));
-    return dagVisit (rw, exp);
+    return rewritePure (std::make_shared<SimplifyBoolExpr>(exp->getFactory()), exp);
   }
 
-  inline static void simplBoolReplCnjHlp(ExprVector& hardVars, ExprSet& cnjs, ExprVector& facts, ExprVector& repls)
+  /**
+   * Unified simplifier: arithmetic and Boolean rules in a single bottom-up pass,
+   * re-applied to every rewritten node until a fixpoint.
+   * The memo survives across calls (see getSimplifier); a result is known to be
+   * its own image only if the last round changed nothing
+   */
+  struct SimplifyExpr
   {
-    bool toRestart;
-    ExprSet toInsert;
+    ExprFactory &efac;
+    SimplifyArithmExpr arithm;
+    SimplifyBoolExpr bools;
+    PersistentVisitCache memo;
+
+    static const int maxRounds = 8;     // per node, in case some rules oscillate
+
+    SimplifyExpr (ExprFactory& _efac) : efac(_efac), arithm(_efac), bools(_efac, false), memo(_efac) {};
+
+    Expr rules (Expr exp)
+    {
+      Expr res = arithm(exp);
+      if (res != exp) return res;
+      return bools(exp);
+    }
 
-    for (auto it = cnjs.begin(); it != cnjs.end(); )
+    Expr simplifyKids (Expr exp)
     {
-      if (isOpX<TRUE>(*it))
+      bool changed = false;
+      ExprVector kids;
+      for (auto it = exp->args_begin(), end = exp->args_end(); it != end; ++it)
       {
-        it = cnjs.erase(it);
-        continue;
+        Expr k = (*this)(*it);
+        changed |= (k != *it);
+        kids.push_back(k);
       }
+      if (!changed) return exp;
+      return efac.mkNary(exp->op(), kids.begin(), kids.end());
+    }
+
+    Expr operator() (Expr exp)
+    {
+      if (exp->arity() == 0) return exp;
 
-      if (isOpX<NEG>(*it))
+      Expr cached = memo.find(exp);
+      if (cached) return cached;
+
+      Expr res = exp;
+      bool fixpoint = false;
+      for (int i = 0; i < maxRounds && !fixpoint; i++)
       {
-        Expr negged = mkNeg((*it)->left());
-        it = cnjs.erase(it);
-        cnjs.insert(negged);
-        continue;
+        res = simplifyKids(res);
+        Expr next = rules(res);
+        fixpoint = (next == res) || (next->arity() == 0);
+        res = next;
+      }
+
+      memo.insert(exp, res);
+      if (fixpoint) memo.insert(res, res);
+      return res;
+    }
+  };
+
+  inline static SimplifyExpr& getSimplifier (ExprFactory &efac)
+  {
+    return FactoryLocal<SimplifyExpr>::get(efac);
+  }
+
+  inline static Expr simplify (Expr exp)
+  {
+    return getSimplifier(exp->getFactory())(exp);
+  }
+
+  inline static bool addReplFact(Expr fact, Expr repl, ExprVector& facts, ExprVector& repls, Substitution& subst)
+  {
+    // Boolean facts are composed into subst, so each conjunct is rewritten once;
+    // arithmetic ones are not resolved against each other (the terms could blow up)
+    bool added = (isOpX<TRUE>(repl) || isOpX<FALSE>(repl)) ?
+      subst.compose(fact, repl) : subst.add(fact, repl);
+    if (!added) return false;
+    facts.push_back(fact);
+    repls.push_back(repl);
+    return true;
+  }
+
+  /**
+   * Conjuncts of simplBoolReplCnj with occurrence lists: a conjunct is
+   * revisited only when a fact about a constant it mentions is learned
+   */
+  struct ReplCnjWorklist
+  {
+    ExprVector items;
+    vector<bool> alive;
+    vector<bool> queued;
+    map<Expr, vector<int>> occs;
+    deque<int> todo;
+
+    void add (Expr c, bool toQueue)
+    {
+      int i = items.size();
+      items.push_back(c);
+      alive.push_back(true);
+      queued.push_back(toQueue);
+      if (toQueue) todo.push_back(i);
+
+      for (ENode *v : constsOf(c)) occs[v].push_back(i);
+    }
+
+    /**
+     * Add a conjunct produced while processing another one. It can still mention
+     * a key through the image of an arithmetic fact (images are not resolved
+     * against each other), so subst is applied once more. Deeper chains are left:
+     * resolving them to a fixpoint can blow up the terms
+     */
+    void addRewritten (Expr c, Substitution& subst)
+    {
+      add(subst(c), false);
+    }
+
+    void learned (Expr fact)
+    {
+      if (isOpX<NEG>(fact)) fact = fact->left();
+      auto it = occs.find(fact);
+      if (it == occs.end()) return;
+      for (int i : it->second)
+      {
+        if (!alive[i] || queued[i]) continue;
+        queued[i] = true;
+        todo.push_back(i);
       }
+    }
+  };
+
+  inline static void simplBoolReplCnjHlp(ExprVector& hardVars, ExprSet& cnjs, ExprVector& facts, ExprVector& repls,
+                                         Substitution& subst)
+  {
+    ExprSet hard(hardVars.begin(), hardVars.end());
+    ReplCnjWorklist wl;
+    for (auto & c : cnjs) wl.add(c, true);
 
-      Expr a = replaceAll(*it, facts, repls);
+    while (!wl.todo.empty())
+    {
+      int i = wl.todo.front();
+      wl.todo.pop_front();
+      wl.queued[i] = false;
+      if (!wl.alive[i]) continue;
+      wl.alive[i] = false;
+
+      Expr a = wl.items[i];
+      if (isOpX<TRUE>(a)) continue;
+      if (isOpX<NEG>(a)) a = mkNeg(a->left());
+
+      a = subst(a);
 
       if (isOpX<IMPL>(a))
       {
-        Expr lhs = simplifyBool(a->left());
+        Expr lhs = simplify(a->left());
         bool isTrue = isOpX<TRUE>(lhs);
         bool isFalse = isOpX<FALSE>(lhs);
 
-        if (isTrue) a = simplifyBool(a->right());
+        if (isTrue) a = simplify(a->right());
         else if (isFalse) continue;
       }
 
@@ -1124,91 +1259,57 @@ namespace ufo
       {
         // TODO: this could be symmetric
 
-        Expr lhs = simplifyBool(a->left());
+        Expr lhs = simplify(a->left());
         bool isTrue = isOpX<TRUE>(lhs);
         bool isFalse = isOpX<FALSE>(lhs);
 
-        if (isTrue) a = simplifyBool(a->right());
+        if (isTrue) a = simplify(a->right());
         else if (isFalse)
         {
-          a = simplifyBool(mk<NEG>(a->right()));
+          a = simplify(mk<NEG>(a->right()));
         }
       }
 
       ExprSet splitted;
       getConj(a, splitted);
-      toRestart = false;
+      ExprVector newFacts;
 
       for (auto & c : splitted)
       {
-        if (bind::isBoolConst(c))
+        if (isOpX<TRUE>(c)) continue;
+
+        if (bind::isBoolConst(c) && hard.find(c) == hard.end())
         {
-          bool nothard = find(hardVars.begin(), hardVars.end(), c) == hardVars.end();
-          if (nothard)
-          {
-            toRestart = true;
-            facts.push_back(c);
-            repls.push_back(mk<TRUE>(a->getFactory()));
-            facts.push_back(mk<NEG>(c));
-            repls.push_back(mk<FALSE>(a->getFactory()));
-          }
-          else
-          {
-            toInsert.insert(c);
-          }
+          if (addReplFact(c, mk<TRUE>(a->getFactory()), facts, repls, subst)) newFacts.push_back(c);
+          addReplFact(mk<NEG>(c), mk<FALSE>(a->getFactory()), facts, repls, subst);
         }
-        else if (isOpX<NEG>(c) && bind::isBoolConst(c->left()))
+        else if (isOpX<NEG>(c) && bind::isBoolConst(c->left()) && hard.find(c->left()) == hard.end())
         {
-          bool nothardLeft = find(hardVars.begin(), hardVars.end(), c->left()) == hardVars.end();
-          if (nothardLeft)
-          {
-            toRestart = true;
-            facts.push_back(c);
-            repls.push_back(mk<TRUE>(a->getFactory()));
-            facts.push_back(c->left());
-            repls.push_back(mk<FALSE>(a->getFactory()));
-          }
-          else
-          {
-            toInsert.insert(c);
-          }
+          if (addReplFact(c, mk<TRUE>(a->getFactory()), facts, repls, subst)) newFacts.push_back(c);
+          addReplFact(c->left(), mk<FALSE>(a->getFactory()), facts, repls, subst);
         }
-        else if (isOpX<EQ>(c))
+        else if (isOpX<EQ>(c) && bind::isIntConst(c->left()) && hard.find(c->left()) == hard.end())
         {
-          if (bind::isIntConst(c->left())  &&
-              find(hardVars.begin(), hardVars.end(), c->left()) == hardVars.end())
-          {
-            toRestart = true;
-            facts.push_back(c->left());
-            repls.push_back(c->right());
-          }
-          else if (bind::isIntConst(c->right())  &&
-                   find(hardVars.begin(), hardVars.end(), c->right()) == hardVars.end())
-          {
-            toRestart = true;
-            facts.push_back(c->right());
-            repls.push_back(c->left());
-          }
-          else
-          {
-            toInsert.insert(c);
-          }
+          if (addReplFact(c->left(), c->right(), facts, repls, subst)) newFacts.push_back(c->left());
+          else wl.addRewritten(c, subst);
+        }
+        else if (isOpX<EQ>(c) && bind::isIntConst(c->right()) && hard.find(c->right()) == hard.end())
+        {
+          if (addReplFact(c->right(), c->left(), facts, repls, subst)) newFacts.push_back(c->right());
+          else wl.addRewritten(c, subst);
         }
         else
         {
-          toInsert.insert(c);
+          wl.addRewritten(c, subst);
         }
       }
 
-      it = cnjs.erase(it);
-      if (toRestart) break;
+      for (auto & f : newFacts) wl.learned(f);
     }
 
-    cnjs.insert(toInsert.begin(), toInsert.end());
-    if (toRestart)
-    {
-      simplBoolReplCnjHlp(hardVars, cnjs, facts, repls);
-    }
+    cnjs.clear();
+    for (int i = 0; i < wl.items.size(); i++)
+      if (wl.alive[i]) cnjs.insert(wl.items[i]);
   }
 
   // simplification based on boolean replacements
@@ -1216,8 +1317,9 @@ namespace ufo
   {
     ExprVector facts;
     ExprVector repls;
+    Substitution subst;
 
-    simplBoolReplCnjHlp(hardVars, cnjs, facts, repls);
+    simplBoolReplCnjHlp(hardVars, cnjs, facts, repls, subst);
 
     for (int i = 0; i < facts.size() ; i++)
       if (!isOpX<NEG>(facts[i]))
@@ -1239,7 +1341,7 @@ namespace ufo
         {
           Expr e = exp->arg(i);
           if (isOpX<MPZ>(e))
-            e = mkTerm (mpq_class (lexical_cast<int>(e)), exp->getFactory());
+            e = mkTerm (mpq_class (getTermRef<mpz_class>(e)), exp->getFactory());
           else {
             e = convertIntsToReals<PLUS>(e);
             e = convertIntsToReals<MINUS>(e);
@@ -1256,20 +1358,13 @@ namespace ufo
 
   template <typename T> static Expr convertIntsToReals (Expr exp)
   {
-    RW<IntToReal<T>> rw(new IntToReal<T>());
-    return dagVisit (rw, exp);
+    return rewritePure (std::make_shared<IntToReal<T>>(), exp);
   }
 
   inline static ExprSet minusSets(ExprSet& v1, ExprSet& v2){
     ExprSet v3;
-    bool res;
-    for (auto &var1: v1){
-      res = true;
-      for (auto &var2: v2){
-        if (var1 == var2) { res = false; break;}
-      }
-      if (res) v3.insert(var1);
-    }
+    for (auto &var1: v1)
+      if (v2.count(var1) == 0) v3.insert(v3.end(), var1);
     return v3;
   }
 
@@ -1278,11 +1373,8 @@ namespace ufo
    */
   inline bool containsOnlyOf(Expr a, Expr b)
   {
-    ExprVector av;
-    filter (a, bind::IsConst (), back_inserter (av));
-    if (av.size() == 1) if (av[0] == b) return true;
-
-    return false;
+    auto &av = constsOf(a);
+    return av.size() == 1 && av[0] == &*b;
   }
 
   inline static Expr simplifiedAnd (Expr a, Expr b){
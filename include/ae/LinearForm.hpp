@@ -0,0 +1,280 @@
+#ifndef LINEARFORM__HPP__
+#define LINEARFORM__HPP__
+#include <assert.h>
+
+#include "ufo/Smt/EZ3.hh"
+
+using namespace std;
+using namespace boost;
+namespace ufo
+{
+
+  /**
+   * Sparse linear form c_1 * a_1 + ... + c_n * a_n + cst over LIA/LRA.
+   * Atoms a_i are variables or non-arithmetic subterms (e.g., ITE-s),
+   * kept sorted by their id; zero coefficients are never stored
+   */
+  class LinearForm
+  {
+  public:
+
+    typedef pair<Expr, mpq_class> Term;
+
+    vector<Term> terms;
+    mpq_class cst;
+
+    LinearForm () : cst(0) {}
+
+    /**
+     * Self explanatory
+     */
+    mpq_class coef (Expr atom) const
+    {
+      auto it = lower_bound (terms.begin(), terms.end(), atom, cmpTerm);
+      if (it != terms.end() && it->first == atom) return it->second;
+      return 0;
+    }
+
+    bool isConst () const { return terms.empty(); }
+
+    void scale (const mpq_class &c)
+    {
+      if (c == 0)
+      {
+        terms.clear();
+        cst = 0;
+        return;
+      }
+      for (auto & a : terms) a.second *= c;
+      cst *= c;
+    }
+
+    void negate () { scale (-1); }
+
+    /**
+     * this += c * lf (single merge of two sorted vectors)
+     */
+    void add (const LinearForm &lf, const mpq_class &c = 1)
+    {
+      vector<Term> res;
+      res.reserve (terms.size() + lf.terms.size());
+      auto it1 = terms.begin();
+      auto it2 = lf.terms.begin();
+      while (it1 != terms.end() || it2 != lf.terms.end())
+      {
+        if (it2 == lf.terms.end() ||
+            (it1 != terms.end() && cmpId (it1->first, it2->first)))
+        {
+          res.push_back (*it1++);
+        }
+        else if (it1 == terms.end() || cmpId (it2->first, it1->first))
+        {
+          res.push_back (Term (it2->first, c * it2->second));
+          it2++;
+        }
+        else
+        {
+          mpq_class sum = it1->second + c * it2->second;
+          if (sum != 0) res.push_back (Term (it1->first, sum));
+          it1++;
+          it2++;
+        }
+      }
+      terms.swap (res);
+      cst += c * lf.cst;
+    }
+
+    void addAtom (Expr atom, const mpq_class &c)
+    {
+      LinearForm lf;
+      lf.terms.push_back (Term (atom, c));
+      add (lf);
+    }
+
+    /**
+     * Parse a numeric Expr; return false if it is not linear
+     */
+    bool fromExpr (Expr e)
+    {
+      terms.clear();
+      cst = 0;
+      return addExpr (e, 1);
+    }
+
+    /**
+     * Build a (sorted) sum; returns NULL if some coefficient is fractional while isInt
+     */
+    Expr toExpr (ExprFactory &efac, bool isInt) const
+    {
+      ExprVector args;
+      for (auto & a : terms)
+      {
+        if (a.second == 1) args.push_back (a.first);
+        else
+        {
+          Expr c = mkNum (a.second, efac, isInt);
+          if (c == NULL) return NULL;
+          args.push_back (mk<MULT>(c, a.first));
+        }
+      }
+      if (cst != 0 || args.empty())
+      {
+        Expr c = mkNum (cst, efac, isInt);
+        if (c == NULL) return NULL;
+        args.push_back (c);
+      }
+      if (args.size() == 1) return args[0];
+      return mknary<PLUS>(args);
+    }
+
+    static Expr mkNum (const mpq_class &c, ExprFactory &efac, bool isInt)
+    {
+      if (!isInt) return mkTerm (c, efac);
+      if (c.get_den() != 1) return NULL;
+      return mkTerm (mpz_class (c.get_num()), efac);
+    }
+
+  private:
+
+    static bool cmpId (Expr a, Expr b) { return a->getId() < b->getId(); }
+
+    static bool cmpTerm (const Term &t, Expr atom) { return cmpId (t.first, atom); }
+
+    static bool getNum (Expr e, mpq_class &c)
+    {
+      if (isOpX<MPZ>(e)) c = getTerm<mpz_class>(e);
+      else if (isOpX<MPQ>(e)) c = getTerm<mpq_class>(e);
+      else return false;
+      return true;
+    }
+
+    bool addExpr (Expr e, const mpq_class &c)
+    {
+      mpq_class n;
+      if (getNum (e, n))
+      {
+        cst += c * n;
+      }
+      else if (isOpX<PLUS>(e))
+      {
+        for (auto it = e->args_begin(), end = e->args_end(); it != end; ++it)
+          if (!addExpr (*it, c)) return false;
+      }
+      else if (isOpX<MINUS>(e))
+      {
+        if (!addExpr (e->arg(0), c)) return false;
+        for (unsigned i = 1; i < e->arity(); i++)
+          if (!addExpr (e->arg(i), -c)) return false;
+      }
+      else if (isOpX<UN_MINUS>(e))
+      {
+        return addExpr (e->left(), -c);
+      }
+      else if (isOpX<MULT>(e))
+      {
+        // at most one non-numeral factor
+        mpq_class k = c;
+        Expr rest;
+        for (auto it = e->args_begin(), end = e->args_end(); it != end; ++it)
+        {
+          if (getNum (*it, n)) k *= n;
+          else if (rest == NULL) rest = *it;
+          else return false;
+        }
+        if (rest == NULL) cst += k;
+        else return addExpr (rest, k);
+      }
+      else if (isOpX<DIV>(e) && e->arity() == 2 && getNum (e->right(), n) && n != 0)
+      {
+        return addExpr (e->left(), c / n);
+      }
+      else if (isOp<NumericOp>(e))
+      {
+        return false; // MOD, IDIV, ...
+      }
+      else if (c != 0)
+      {
+        addAtom (e, c);
+      }
+      return true;
+    }
+  };
+
+  /**
+   * Rewrite a linear comparison to `var OP rhs` (or `k * var OP rhs` for integers
+   * if |k| != 1); returns NULL if var does not occur linearly
+   */
+  inline Expr isolateVar (Expr cmp, Expr var, bool isInt)
+  {
+    if (!isOp<ComparissonOp>(cmp) || cmp->arity() != 2) return NULL;
+
+    LinearForm lf;
+    LinearForm r;
+    if (!lf.fromExpr (cmp->left()) || !r.fromExpr (cmp->right())) return NULL;
+    lf.add (r, -1);
+
+    mpq_class k = lf.coef (var);
+    if (k == 0) return NULL;
+
+    // k * var + rest OP 0  -->  var OP -rest / k
+    lf.addAtom (var, -k);
+    for (auto & a : lf.terms) if (contains (a.first, var)) return NULL;
+
+    bool flip = (k < 0);
+    ExprFactory &efac = cmp->getFactory();
+    Expr lhs = var;
+    if (isInt)
+    {
+      if (!flip) lf.negate();
+      if (abs (k) != 1) lhs = mk<MULT>(LinearForm::mkNum (abs (k), efac, true), var);
+    }
+    else
+    {
+      lf.scale (mpq_class (-1) / k);
+    }
+
+    Expr rhs = lf.toExpr (efac, isInt);
+    if (rhs == NULL) return NULL;
+
+    if (isOpX<EQ>(cmp)) return mk<EQ>(lhs, rhs);
+    if (isOpX<NEQ>(cmp)) return mk<NEQ>(lhs, rhs);
+    if (isOpX<LEQ>(cmp)) return flip ? mk<GEQ>(lhs, rhs) : mk<LEQ>(lhs, rhs);
+    if (isOpX<GEQ>(cmp)) return flip ? mk<LEQ>(lhs, rhs) : mk<GEQ>(lhs, rhs);
+    if (isOpX<LT>(cmp)) return flip ? mk<GT>(lhs, rhs) : mk<LT>(lhs, rhs);
+    if (isOpX<GT>(cmp)) return flip ? mk<LT>(lhs, rhs) : mk<GT>(lhs, rhs);
+    return NULL;
+  }
+
+  /**
+   * Canonical (sorted) sum of a linear term; returns NULL unless all its atoms
+   * are integer (or all are real) constants, since the sort is unknown otherwise
+   */
+  inline Expr sortedSum (Expr e)
+  {
+    LinearForm lf;
+    if (!lf.fromExpr (e) || lf.isConst()) return NULL;
+
+    bool allInt = true, allReal = true;
+    for (auto & a : lf.terms)
+    {
+      allInt &= bind::isIntConst (a.first);
+      allReal &= bind::isRealConst (a.first);
+    }
+    if (!allInt && !allReal) return NULL;
+    return lf.toExpr (e->getFactory(), allInt);
+  }
+
+  /**
+   * Check if a - b is zero as a linear form
+   */
+  inline bool sameLinear (Expr a, Expr b)
+  {
+    LinearForm la;
+    LinearForm lb;
+    if (!la.fromExpr (a) || !lb.fromExpr (b)) return false;
+    la.add (lb, -1);
+    return la.isConst() && la.cst == 0;
+  }
+}
+
+#endif
@@ -2,7 +2,10 @@
 #define SMTUTILS__HPP__
 #include <assert.h>
 
+#include <deque>
+
 #include "ae/ExprSimpl.hpp"
+#include "ae/ExprEval.hpp"
 #include "ufo/Smt/EZ3.hh"
 
 using namespace std;
@@ -16,6 +19,37 @@ namespace ufo
     ExprFactory &efac;
     EZ3 z3;
     ZSolver<EZ3> smt;
+
+    /** concrete models of earlier satisfiable checks, most recently useful first */
+    deque<ConcreteModel> models;
+    static const unsigned maxModels = 16;
+
+    /**
+     * Search the pool for a model of a /\ b (compiled once for all models);
+     * a hit is moved to the front
+     */
+    bool satByModel (Expr a, Expr b)
+    {
+      Expr ab = mk<AND>(b, a);
+      std::unique_ptr<EvalProgram> prog;
+      for (auto it = models.begin (); it != models.end (); ++it)
+      {
+        if (!it->covers (ab)) continue;
+        if (!prog) prog.reset (new EvalProgram (ab));
+        // -- an undecided evaluation is no witness of satisfiability
+        boost::tribool r = prog->runBool (*it);
+        if (indeterminate (r) || !r) continue;
+        if (it != models.begin ())
+        {
+          ConcreteModel m;
+          swap (m, *it);
+          models.erase (it);
+          models.push_front (m);
+        }
+        return true;
+      }
+      return false;
+    }
     
   public:
     
@@ -45,7 +79,7 @@ namespace ufo
           if (bind::isBoolConst(v))
           eqs.push_back(mk<EQ>(v, mk<TRUE>(efac)));
           else if (bind::isIntConst(v))
-          eqs.push_back(mk<EQ>(v, mkTerm (mpz_class (0), efac)));
+          eqs.push_back(mk<EQ>(v, efac.mkZero()));
         }
       }
       return conjoin (eqs, efac);
@@ -60,7 +94,7 @@ namespace ufo
       if (reset) smt.reset();
       for (auto & c : cnjs)
       {
-        filter (c, bind::IsConst (), inserter (allVars, allVars.begin()));
+        getConsts (c, allVars);
         if (isOpX<FORALL>(c))
         {
           ExprVector varz;
@@ -109,13 +143,34 @@ namespace ufo
     }
 
     /**
-     * SMT-based implication check
+     * Keep the values of vars in m for refuting later implication checks
+     */
+    template <typename Range> void addModel (ZSolver<EZ3>::Model &m, const Range &vars)
+    {
+      ConcreteModel cm;
+      getConcreteModel (m, vars, cm);
+      if (cm.size () == 0) return;
+      if (models.size () == maxModels) models.pop_back ();
+      models.push_front (cm);
+    }
+
+    /**
+     * SMT-based implication check. Counterexamples among the kept models
+     * refute it without a call to the solver
      */
     bool implies (Expr a, Expr b)
     {
       if (isOpX<TRUE>(b)) return true;
       if (isOpX<FALSE>(a)) return true;
-      return ! isSat(a, mkNeg(b));
+      Expr nb = mkNeg(b);
+      if (satByModel (a, nb)) return false;
+      boost::tribool res = isSat(a, nb);
+      if (res)
+      {
+        ZSolver<EZ3>::Model m = smt.getModel();
+        addModel (m, allVars);
+      }
+      return ! res;
     }
 
     /**
@@ -306,15 +361,15 @@ namespace ufo
      */
     Expr numericUnderapprox(Expr exp)
     {
-      ExprVector cnstr_vars;
-      filter (exp, bind::IsConst (), back_inserter (cnstr_vars));
+      auto &cnstr_vars = constsOf(exp);
       if (cnstr_vars.size() == 1)
       {
+        Expr var = cnstr_vars[0];
         smt.reset();
         smt.assertExpr (exp);
         if (smt.solve ()) {
           ZSolver<EZ3>::Model m = smt.getModel();
-          return mk<EQ>(cnstr_vars[0], m.eval(cnstr_vars[0]));
+          return mk<EQ>(var, m.eval(var));
         }
       }
       return exp;
@@ -335,6 +390,13 @@ namespace ufo
 
     void print (Expr e)
     {
+      // -- Z3 binds shared subterms by let, so a Skolem is printed as large as its DAG
+      if (!containsOp<FORALL>(e) && !containsOp<EXISTS>(e))
+      {
+        outs () << z3.toSmtLib (e);
+        return;
+      }
+
       if (isOpX<FORALL>(e) || isOpX<EXISTS>(e))
       {
         if (isOpX<FORALL>(e)) outs () << "(forall (";
@@ -0,0 +1,510 @@
+#ifndef SKOLEMC__HPP__
+#define SKOLEMC__HPP__
+#include <assert.h>
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+
+#include "ufo/Expr.hpp"
+
+using namespace std;
+using namespace boost;
+namespace ufo
+{
+  /**
+   * Lowers Skolem functions to C, one function per existential variable:
+   *
+   *   int aeval_skolem_y (int64_t x, double z, int b, int64_t *_out);
+   *
+   * The body is straight-line code over the DAG of the Skolem, with one local per
+   * subterm. Int terms are int64_t, Real terms are double and Bool terms are int.
+   * A function returns 0 after storing the value, or 1 if the value depends on an
+   * overflow or on a division by zero. Operands of an ITE are computed eagerly, so
+   * errors are propagated as flags and only those of the taken branch count
+   */
+  class SkolemToC
+  {
+    enum Sort { S_NONE, S_BOOL, S_INT, S_REAL };
+
+    /** a C expression, the name of its error flag ("" if it has none), and its sort */
+    struct Val
+    {
+      string v;
+      string e;
+      Sort s;
+    };
+
+    ExprVector params;
+    map<Expr, string> names;
+    set<string> taken;
+    ostringstream funs;
+    string error;
+
+    // -- state of the function being emitted
+    ostringstream body;
+    unordered_map<ENode*, Val> vals;
+    unsigned locals;
+
+    static Sort varSort (Expr v)
+    {
+      if (bind::isBoolConst (v)) return S_BOOL;
+      if (bind::isIntConst (v)) return S_INT;
+      if (bind::isRealConst (v)) return S_REAL;
+      return S_NONE;
+    }
+
+    static const char *cType (Sort s)
+    {
+      return s == S_INT ? "int64_t" : (s == S_REAL ? "double" : "int");
+    }
+
+    /** a fresh C identifier derived from the name of a constant */
+    string mkName (Expr c, const string &prefix)
+    {
+      ostringstream o;
+      o << *c;
+      string n = prefix;
+      for (char ch : o.str ()) n += isalnum ((unsigned char) ch) ? ch : '_';
+      if (n.empty () || isdigit ((unsigned char) n[0]) || n[0] == '_') n = "v" + n;
+
+      static const char *keywords [] = { "auto", "break", "case", "char", "const", "continue",
+        "default", "do", "double", "else", "enum", "extern", "float", "for", "goto", "if",
+        "inline", "int", "long", "register", "restrict", "return", "short", "signed", "sizeof",
+        "static", "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while" };
+      for (const char *k : keywords) if (n == k) n += "_";
+
+      string res = n;
+      for (int i = 1; taken.count (res) > 0; i++) res = n + "_" + lexical_cast<string>(i);
+      taken.insert (res);
+      return res;
+    }
+
+    string fresh (const char *kind, unsigned id)
+    {
+      return string ("_") + kind + lexical_cast<string>(id);
+    }
+
+    static string cInt (const mpz_class &z, bool &ok)
+    {
+      static const mpz_class lo ("-9223372036854775808"), hi ("9223372036854775807");
+      ok = (z >= lo && z <= hi);
+      if (z == lo) return "INT64_MIN";
+      return "INT64_C(" + z.get_str () + ")";
+    }
+
+    static string cReal (const mpq_class &q)
+    {
+      ostringstream o;
+      o << setprecision (17) << q.get_d ();
+      string s = o.str ();
+      if (s.find_first_of (".eni") == string::npos) s += ".0";
+      return s[0] == '-' ? "(" + s + ")" : s;
+    }
+
+    static string asReal (const Val &a)
+    {
+      return a.s == S_INT ? "(double) " + a.v : a.v;
+    }
+
+    /** a new local of sort s, initialized with the C expression v */
+    Val def (Sort s, const string &v, const string &e)
+    {
+      Val r;
+      r.v = fresh ("t", locals++);
+      r.e = e;
+      r.s = s;
+      body << "  const " << cType (s) << " " << r.v << " = " << v << ";\n";
+      return r;
+    }
+
+    /** the error flag of an operation over args, possibly with its own error cond */
+    string joinErr (const vector<const Val*> &args, const string &cond = "")
+    {
+      set<string> es;
+      for (auto a : args) if (!a->e.empty ()) es.insert (a->e);
+      if (cond.empty () && es.size () <= 1) return es.empty () ? "" : *es.begin ();
+
+      string e = fresh ("e", locals++);
+      body << "  int " << e << " = ";
+      bool first = true;
+      for (auto &a : es) { body << (first ? "" : " | ") << a; first = false; }
+      if (!cond.empty ()) body << (first ? "" : " | ") << cond;
+      else if (first) body << "0";
+      body << ";\n";
+      return e;
+    }
+
+    /** n-ary checked integer arithmetic via the builtins of GCC and Clang */
+    Val intChain (const char *builtin, const vector<const Val*> &args)
+    {
+      Val r;
+      r.s = S_INT;
+      r.v = fresh ("t", locals++);
+      body << "  int64_t " << r.v << ";\n";
+      r.e = joinErr (args, string (builtin) + " (" + args[0]->v + ", " + args[1]->v + ", &" + r.v + ")");
+      for (size_t i = 2; i < args.size (); i++)
+        body << "  " << r.e << " |= " << builtin << " (" << r.v << ", " << args[i]->v << ", &" << r.v << ");\n";
+      return r;
+    }
+
+    /** an integer operation implemented by a helper of the prelude */
+    Val intCall (const char *helper, const vector<const Val*> &args)
+    {
+      Val r;
+      r.s = S_INT;
+      r.v = fresh ("t", locals++);
+      body << "  int64_t " << r.v << ";\n";
+      string call = string (helper) + " (";
+      for (auto a : args) call += a->v + ", ";
+      call += "&" + r.v + ")";
+      r.e = joinErr (args, call);
+      return r;
+    }
+
+    Val lowerOp (Expr e, const vector<const Val*> &a)
+    {
+      Val r;
+      r.s = S_NONE;
+      size_t n = a.size ();
+      if (n == 0) return r;
+      for (auto x : a) if (x->s == S_NONE) return r;
+
+      bool anyReal = false;
+      for (auto x : a) anyReal |= (x->s == S_REAL);
+      Sort num = anyReal ? S_REAL : S_INT;
+
+      if (isOpX<AND>(e) || isOpX<OR>(e))
+      {
+        // -- an argument that decides the result masks the errors of the others
+        bool isAnd = isOpX<AND>(e);
+        string v, dec;
+        for (size_t i = 0; i < n; i++)
+        {
+          if (a[i]->s != S_BOOL) return r;
+          v += (i ? (isAnd ? " && " : " || ") : "") + a[i]->v;
+          string d = (isAnd ? "!" : "") + a[i]->v;
+          if (!a[i]->e.empty ()) d = "(" + d + " && !" + a[i]->e + ")";
+          dec += (i ? " || " : "") + d;
+        }
+        string err = joinErr (a);
+        if (err.empty ()) return def (S_BOOL, v, "");
+        Val res = def (S_BOOL, v, "");
+        res.e = fresh ("e", locals++);
+        body << "  const int " << res.e << " = " << err << " && !(" << dec << ");\n";
+        return res;
+      }
+      if (isOpX<NEG>(e) && n == 1 && a[0]->s == S_BOOL)
+        return def (S_BOOL, "!" + a[0]->v, a[0]->e);
+      if ((isOpX<IMPL>(e) || isOpX<IFF>(e) || isOpX<XOR>(e)) && n == 2 &&
+          a[0]->s == S_BOOL && a[1]->s == S_BOOL)
+      {
+        string v = isOpX<IMPL>(e) ? "!" + a[0]->v + " || " + a[1]->v :
+                   a[0]->v + (isOpX<IFF>(e) ? " == " : " != ") + a[1]->v;
+        return def (S_BOOL, v, joinErr (a));
+      }
+      if (isOpX<ITE>(e) && n == 3 && a[0]->s == S_BOOL && (a[1]->s == S_BOOL) == (a[2]->s == S_BOOL))
+      {
+        Sort s = a[1]->s == a[2]->s ? a[1]->s : S_REAL;
+        string t = s == S_REAL ? asReal (*a[1]) : a[1]->v;
+        string f = s == S_REAL ? asReal (*a[2]) : a[2]->v;
+        Val res = def (s, a[0]->v + " ? " + t + " : " + f, "");
+        if (!a[1]->e.empty () || !a[2]->e.empty ())
+        {
+          res.e = fresh ("e", locals++);
+          body << "  const int " << res.e << " = " << (a[0]->e.empty () ? "" : a[0]->e + " | ")
+               << "(" << a[0]->v << " ? " << (a[1]->e.empty () ? "0" : a[1]->e) << " : "
+               << (a[2]->e.empty () ? "0" : a[2]->e) << ");\n";
+        }
+        else res.e = a[0]->e;
+        return res;
+      }
+      if (isOp<ComparissonOp>(e) && n == 2)
+      {
+        const char *op = isOpX<EQ>(e) ? " == " : isOpX<NEQ>(e) ? " != " : isOpX<LEQ>(e) ? " <= " :
+                         isOpX<GEQ>(e) ? " >= " : isOpX<LT>(e) ? " < " : " > ";
+        if ((a[0]->s == S_BOOL) != (a[1]->s == S_BOOL)) return r;
+        if (a[0]->s == S_BOOL && !isOpX<EQ>(e) && !isOpX<NEQ>(e)) return r;
+        string l = num == S_REAL ? asReal (*a[0]) : a[0]->v;
+        string rr = num == S_REAL ? asReal (*a[1]) : a[1]->v;
+        return def (S_BOOL, l + op + rr, joinErr (a));
+      }
+
+      // -- arithmetic
+      for (auto x : a) if (x->s == S_BOOL) return r;
+      if (isOpX<PLUS>(e) || isOpX<MULT>(e) || (isOpX<MINUS>(e) && n > 1))
+      {
+        if (n == 1) return *a[0];
+        const char *op = isOpX<PLUS>(e) ? " + " : isOpX<MULT>(e) ? " * " : " - ";
+        if (num == S_REAL)
+        {
+          string v;
+          for (size_t i = 0; i < n; i++) v += (i ? op : "") + asReal (*a[i]);
+          return def (S_REAL, v, joinErr (a));
+        }
+        return intChain (isOpX<PLUS>(e) ? "__builtin_add_overflow" :
+                         isOpX<MULT>(e) ? "__builtin_mul_overflow" : "__builtin_sub_overflow", a);
+      }
+      if ((isOpX<MINUS>(e) || isOpX<UN_MINUS>(e)) && n == 1)
+      {
+        if (num == S_REAL) return def (S_REAL, "-" + a[0]->v, a[0]->e);
+        return intCall ("aeval_neg", a);
+      }
+      if (isOpX<ABS>(e) && n == 1)
+      {
+        if (num == S_REAL) return def (S_REAL, "fabs (" + a[0]->v + ")", a[0]->e);
+        return intCall ("aeval_abs", a);
+      }
+      if (isOpX<DIV>(e) && n == 2)
+      {
+        // -- integral operands: the quotient has to be exact (as in ExprEval)
+        if (num == S_INT) return intCall ("aeval_exact_div", a);
+        return def (S_REAL, asReal (*a[0]) + " / " + asReal (*a[1]),
+                    joinErr (a, a[1]->v + " == 0"));
+      }
+      if ((isOpX<IDIV>(e) || isOpX<MOD>(e)) && n == 2 && num == S_INT)
+        return intCall (isOpX<IDIV>(e) ? "aeval_div" : "aeval_mod", a);
+      return r;
+    }
+
+    /** C expressions for all subterms of e, children first */
+    bool lower (Expr root)
+    {
+      vector<pair<ENode*, bool> > stack;
+      stack.push_back (make_pair (&*root, false));
+      while (!stack.empty ())
+      {
+        ENode *n = stack.back ().first;
+        bool kidsDone = stack.back ().second;
+        stack.pop_back ();
+        if (vals.count (n) > 0) continue;
+        Expr e (n);
+
+        Val r;
+        r.s = S_NONE;
+        if (bind::IsConst () (e))
+        {
+          auto it = names.find (e);
+          if (it == names.end ()) return fail ("unexpected constant", e);
+          r.v = it->second;
+          r.s = varSort (e);
+        }
+        else if (isOpX<TRUE>(e) || isOpX<FALSE>(e))
+        {
+          r.v = isOpX<TRUE>(e) ? "1" : "0";
+          r.s = S_BOOL;
+        }
+        else if (isOpX<MPZ>(e) || isOpX<INT>(e) ||
+                 (isOpX<MPQ>(e) && getTermRef<mpq_class>(e).get_den () == 1))
+        {
+          bool ok;
+          r.v = cInt (isOpX<MPZ>(e) ? getTermRef<mpz_class>(e) :
+                      isOpX<INT>(e) ? mpz_class (getTerm<int>(e)) :
+                      mpz_class (getTermRef<mpq_class>(e).get_num ()), ok);
+          if (!ok) return fail ("constant out of the range of int64_t", e);
+          r.s = S_INT;
+        }
+        else if (isOpX<MPQ>(e))
+        {
+          r.v = cReal (getTermRef<mpq_class>(e));
+          r.s = S_REAL;
+        }
+        else if (!kidsDone)
+        {
+          stack.push_back (make_pair (n, true));
+          for (size_t i = n->arity (); i > 0; i--)
+            if (vals.count (n->arg (i - 1)) == 0) stack.push_back (make_pair (n->arg (i - 1), false));
+          continue;
+        }
+        else
+        {
+          vector<const Val*> args;
+          for (auto it = n->args_begin (), end = n->args_end (); it != end; ++it)
+            args.push_back (&vals [*it]);
+          r = lowerOp (e, args);
+          if (r.s == S_NONE) return fail ("unsupported term", e);
+        }
+        vals [n] = r;
+      }
+      return true;
+    }
+
+    bool fail (const char *msg, Expr e)
+    {
+      ostringstream o;
+      o << msg << ": " << *e;
+      error = o.str ();
+      return false;
+    }
+
+    /**
+     * Extract the value of var from a Skolem (a conjunction of equalities,
+     * possibly under ITEs); returns NULL if some branch does not define it
+     */
+    static Expr projectDef (Expr skol, Expr var)
+    {
+      if (isOpX<ITE>(skol))
+      {
+        Expr t = projectDef (skol->arg (1), var);
+        Expr f = projectDef (skol->arg (2), var);
+        if (t == NULL || f == NULL) return NULL;
+        return t == f ? t : mk<ITE>(skol->arg (0), t, f);
+      }
+      if (isOpX<AND>(skol))
+      {
+        for (auto it = skol->args_begin (), end = skol->args_end (); it != end; ++it)
+        {
+          Expr d = projectDef (*it, var);
+          if (d != NULL) return d;
+        }
+        return NULL;
+      }
+      if (isOpX<EQ>(skol) || isOpX<IFF>(skol))
+      {
+        if (skol->left () == var) return skol->right ();
+        if (skol->right () == var) return skol->left ();
+      }
+      if (skol == var) return mk<TRUE>(var->getFactory ());
+      if (isOpX<NEG>(skol) && skol->left () == var) return mk<FALSE>(var->getFactory ());
+      return NULL;
+    }
+
+  public:
+
+    /** universals become the parameters of every function, in this order */
+    SkolemToC (const ExprVector &universals) : params (universals), locals (0)
+    {
+      for (auto &p : params) names [p] = mkName (p, "");
+    }
+
+    /** the reason of the last failure */
+    const string &getError () const { return error; }
+
+    /**
+     * Emit the function for var; def may mention existentials already added
+     */
+    bool add (Expr var, Expr def)
+    {
+      Sort s = varSort (var);
+      if (s == S_NONE) return fail ("unsupported sort", var);
+      for (auto &p : params) if (varSort (p) == S_NONE) return fail ("unsupported sort", p);
+
+      body.str ("");
+      vals.clear ();
+      locals = 0;
+      if (!lower (def)) return false;
+      Val &r = vals [&*def];
+      if (r.s == S_BOOL && s != S_BOOL) return fail ("Boolean value of a numeric variable", var);
+      if (r.s != S_BOOL && s == S_BOOL) return fail ("numeric value of a Boolean variable", var);
+
+      string fname = mkName (var, "aeval_skolem_");
+      funs << "\n/* " << *var << " */\n"
+           << "int " << fname << " (";
+      for (auto &p : params) funs << cType (varSort (p)) << " " << names [p] << ", ";
+      funs << cType (s) << " *_out)\n{\n" << body.str ();
+
+      string v = r.v;
+      string e = r.e;
+      if (s == S_REAL && r.s == S_INT) v = asReal (r);
+      if (s == S_INT && r.s == S_REAL)
+      {
+        funs << "  int64_t _res;\n"
+             << "  if (aeval_to_int (" << v << ", &_res)) return 1;\n";
+        v = "_res";
+      }
+      if (!e.empty ()) funs << "  if (" << e << ") return 1;\n";
+      funs << "  *_out = " << v << ";\n"
+           << "  return 0;\n}\n";
+      return true;
+    }
+
+    /**
+     * Emit the functions for all vars given their Skolem (either separate
+     * Skolems in defs, or one joint Skolem in skol)
+     */
+    bool addAll (const ExprSet &vars, Expr skol, ExprMap &defs)
+    {
+      ExprMap closed;
+      for (auto &v : vars)
+      {
+        Expr d = defs.count (v) > 0 ? defs [v] : Expr ();
+        if (d == NULL && skol != NULL)
+        {
+          // -- a trivial Skolem allows any value
+          if (isOpX<TRUE>(skol))
+            d = bind::isBoolConst (v) ? mk<TRUE>(v->getFactory ()) : v->getFactory ().mkZero ();
+          else
+            d = projectDef (skol, v);
+        }
+        if (d == NULL) return fail ("no Skolem for", v);
+        closed [v] = d;
+      }
+
+      // -- Skolems may depend on other existentials: substitute until a fixpoint
+      for (size_t i = 0; i <= vars.size (); i++)
+      {
+        bool changed = false;
+        for (auto &a : closed)
+        {
+          Expr d = replaceAll (a.second, closed);
+          changed |= (d != a.second);
+          a.second = d;
+        }
+        if (!changed) break;
+        if (i == vars.size ()) return fail ("cyclic Skolem for", closed.begin ()->first);
+      }
+
+      for (auto &v : vars) if (!add (v, closed [v])) return false;
+      return true;
+    }
+
+    void print (ostream &out)
+    {
+      out << "/* Skolem functions generated by AE-VAL */\n"
+          << "#include <stdint.h>\n"
+          << "#include <math.h>\n"
+          << "\n"
+          << "static inline int aeval_neg (int64_t a, int64_t *r)\n"
+          << "{\n"
+          << "  return __builtin_sub_overflow ((int64_t) 0, a, r);\n"
+          << "}\n"
+          << "\n"
+          << "static inline int aeval_abs (int64_t a, int64_t *r)\n"
+          << "{\n"
+          << "  return a < 0 ? aeval_neg (a, r) : (*r = a, 0);\n"
+          << "}\n"
+          << "\n"
+          << "/* SMT-LIB div and mod: the remainder is non-negative */\n"
+          << "static inline int aeval_div (int64_t a, int64_t b, int64_t *r)\n"
+          << "{\n"
+          << "  if (b == 0 || (a == INT64_MIN && b == -1)) { *r = 0; return 1; }\n"
+          << "  *r = a / b;\n"
+          << "  if (a % b < 0) *r += b > 0 ? -1 : 1;\n"
+          << "  return 0;\n"
+          << "}\n"
+          << "\n"
+          << "static inline int aeval_mod (int64_t a, int64_t b, int64_t *r)\n"
+          << "{\n"
+          << "  if (b == 0) { *r = 0; return 1; }\n"
+          << "  *r = b == -1 ? 0 : a % b;\n"
+          << "  if (*r < 0) *r = b > 0 ? *r + b : *r - b;\n"
+          << "  return 0;\n"
+          << "}\n"
+          << "\n"
+          << "static inline int aeval_exact_div (int64_t a, int64_t b, int64_t *r)\n"
+          << "{\n"
+          << "  int64_t m;\n"
+          << "  return aeval_mod (a, b, &m) | (m != 0) | aeval_div (a, b, r);\n"
+          << "}\n"
+          << "\n"
+          << "static inline int aeval_to_int (double a, int64_t *r)\n"
+          << "{\n"
+          << "  if (!(a >= -9223372036854775808.0 && a < 9223372036854775808.0)) { *r = 0; return 1; }\n"
+          << "  *r = (int64_t) a;\n"
+          << "  return (double) *r != a;\n"
+          << "}\n"
+          << funs.str ();
+    }
+  };
+}
+
+#endif
@@ -22,6 +22,9 @@ DM-0002198
 #pragma clang diagnostic ignored "-Wpotentially-evaluated-expression"
 
 #include <typeinfo>
+#include <type_traits>
+#include <cassert>
+#include <cstdint>
 #include <algorithm>
 #include <set>
 #include <map>
@@ -52,7 +55,8 @@ DM-0002198
 
 #define mk_it_range boost::make_iterator_range
 
-#define NOP_BASE(NAME) struct NAME : public expr::Operator {};
+#define NOP_BASE(NAME) \
+  struct NAME : public expr::Operator { typedef NAME category_type; };
 
 #define NOP(NAME,TEXT,STYLE,BASE)		\
   struct __ ## NAME { static inline std::string name () { return TEXT; } }; \
@@ -70,7 +74,23 @@ namespace expr
   class ENode;
   class ExprFactory;
   class ExprFactoryAllocator;
-  
+}
+
+namespace std
+{
+  /**
+   * Standard order of expressions by their id (defined below).
+   * Declared before any ordered container of expressions is used, so that
+   * ExprSet and ExprMap never fall back to the order of addresses
+   */
+  template <> struct less<expr::ENode*>
+  {
+    bool operator() (const expr::ENode *x, const expr::ENode *y) const;
+  };
+}
+
+namespace expr
+{
   typedef boost::intrusive_ptr<ENode> Expr;
   typedef std::set<Expr> ExprSet;
   typedef std::vector<Expr> ExprVector;
@@ -92,9 +112,19 @@ namespace expr
   /* An operator (a.k.a. a tag) of an expression node */
   class Operator
   {
+  protected:
+    /** opcode of the concrete type (see opCode), 0 if it does not set one */
+    unsigned m_code;
+    /** categories (NOP_BASE) the operator belongs to, as a bitmask */
+    unsigned m_cats;
+
   public:
+    Operator () : m_code (0), m_cats (0) {}
     virtual ~Operator () {};
 
+    unsigned code () const { return m_code; }
+    unsigned categories () const { return m_cats; }
+
     /** Print an expression rooted at the operator
 	OS    -- the output strream
 	args  -- the arguments of the operator
@@ -121,6 +151,68 @@ namespace expr
     return OS;
   }
 
+  namespace details
+  {
+    inline unsigned nextOpCode ()
+    {
+      static unsigned last = 0;
+      return ++last;
+    }
+
+    inline unsigned nextOpCategory ()
+    {
+      static unsigned last = 0;
+      assert (last < 32 && "too many operator categories");
+      return 1u << last++;
+    }
+  }
+
+  /**
+   * Opcode of an operator type: a small non-zero integer, assigned to
+   * each type once, on first use. Testing the opcode replaces RTTI
+   */
+  template <typename O> unsigned opCode ()
+  {
+    static const unsigned code = details::nextOpCode ();
+    return code;
+  }
+
+  /** Bit of an operator category (a base declared by NOP_BASE) */
+  template <typename O> unsigned opCategory ()
+  {
+    static const unsigned bit = details::nextOpCategory ();
+    return bit;
+  }
+
+  /** Whether O is a category, i.e., is declared by NOP_BASE */
+  template <typename O, typename = void>
+  struct IsOpCategory : std::false_type {};
+  template <typename O>
+  struct IsOpCategory<O, typename std::enable_if
+                      <std::is_same<typename O::category_type,O>::value>::type>
+    : std::true_type {};
+
+  template <typename O>
+  unsigned opCategories (std::true_type) { return opCategory<O> (); }
+  template <typename O>
+  unsigned opCategories (std::false_type) { return 0; }
+
+
+  /**
+   * Structural facts about a node, computed on first request (see nodeMeta)
+   * and owned by the node, so they live and die with it
+   */
+  struct ENodeMeta
+  {
+    typedef std::vector<ENode*> consts_type;
+
+    /** constants (as by bind::IsConst), sorted by id; shared with a child if equal */
+    std::shared_ptr<const consts_type> consts;
+    /** size as a tree, in the measure of treeSize (saturated) */
+    size_t treeSize;
+    /** number of nodes on the longest path to a leaf */
+    unsigned depth;
+  };
 
   /* An expression node (a.k.a. an enode). A pointer into an
      expression tree (or DAG)  */
@@ -128,9 +220,9 @@ namespace expr
   {
   private:
     // // -- no default constructor
-    ENode () : id(0), count(0), fac(NULL) {}
+    ENode () : id(0), count(0), fac(NULL), meta(NULL) {}
     // // -- no copy constructor
-    ENode (const ENode &) : count(0), fac(NULL) {}
+    ENode (const ENode &) : count(0), fac(NULL), meta(NULL) {}
   protected:
     /** unique identifier of this expression node */
     unsigned int id;
@@ -141,6 +233,9 @@ namespace expr
     std::vector<ENode*> args;
 
     std::shared_ptr<Operator> oper;
+
+    /** cached structural facts, NULL until requested */
+    mutable ENodeMeta *meta;
     
     
     void Deref () { if (count > 0) count--; }
@@ -200,6 +295,7 @@ namespace expr
     friend struct LessENode;
     friend class ExprFactory;
     friend struct std::less<expr::ENode*>;
+    friend const ENodeMeta &nodeMeta (ENode *e);
   };
 
   
@@ -309,6 +405,8 @@ namespace expr
     virtual bool owns (const void *p) = 0;
     /** erases val from the underlying cache */
     virtual void erase (ENode *val) = 0;
+    /** the factory is going away: drop all entries and forget it */
+    virtual void detach () = 0;
     virtual ~CacheStub () { }
   };
   
@@ -322,6 +420,7 @@ namespace expr
     
     virtual bool owns (const void *p) { return p == static_cast<const void*> (&cache); }
     virtual void erase (ENode *val) { cache.erase (val); }
+    virtual void detach () { cache.detach (); }
   };
   
 
@@ -490,6 +589,9 @@ namespace expr
       return canonize (eVal);
     }
 
+    /** pre-interned common constants (see mkTrue and others) */
+    Expr trueE, falseE, zeroE, oneE, minusOneE;
+
   private:
 
 
@@ -504,6 +606,19 @@ namespace expr
   public:
     ExprFactory () : idCount(0) {}
 
+    ~ExprFactory ()
+    {
+      // -- caches may outlive the factory (e.g., static memos);
+      // -- release their entries while the nodes can still be freed
+      // -- (a detached cache may in turn destroy and unregister others)
+      while (!caches.empty ())
+	{
+	  caches_type::auto_type c = caches.pop_back ();
+	  c->detach ();
+	}
+      trueE = falseE = zeroE = oneE = minusOneE = NULL;
+    }
+
     /** Derefernce a value */
     void Deref (ENode* val)
     {
@@ -513,6 +628,13 @@ namespace expr
 
     /** User functions */
     Expr mkTerm (const Operator &o) { return Expr (mkExpr (o)); }
+
+    /** Common constants, interned once and kept for the lifetime of the factory */
+    Expr mkTrue ();
+    Expr mkFalse ();
+    Expr mkZero ();
+    Expr mkOne ();
+    Expr mkMinusOne ();
     Expr mkUnary (const Operator &o, Expr e) 
     { return Expr (mkExpr (o, e.get ())); }
     Expr mkBin (const Operator &o, Expr e1, Expr e2)
@@ -556,10 +678,11 @@ namespace expr
   };
 
   inline ENode::ENode (ExprFactory &f, const Operator &o) :
-    count(0), fac(&f), 
+    count(0), fac(&f),
     oper(o.clone (f.allocator), 
 	 f.allocator.get_deleter (),
-	 boost::pool_allocator<char> ()) {}
+	 boost::pool_allocator<char> ()),
+    meta(NULL) {}
 }
 
 inline void * operator new (size_t n, expr::ExprFactoryAllocator &alloc)
@@ -572,6 +695,10 @@ namespace expr
 {
   inline void ExprFactory::freeNode (ENode *n)
   {
+    // -- nodes are recycled without running ~ENode
+    delete n->meta;
+    n->meta = NULL;
+
     if (freeList.size () < FREE_LIST_MAX_SIZE) 
       {      
 	for (ENode *a : n->args) Deref (a);
@@ -639,9 +766,10 @@ namespace expr
     typedef P terminal_type;
     typedef Terminal<T,P> this_type;
     
-    Terminal (const base_type &v) : val(v) {}
+    Terminal (const base_type &v) : val(v) { this->m_code = opCode<this_type> (); }
 
     base_type get () const { return val; }
+    const base_type &ref () const { return val; }
 
     this_type* clone (ExprFactoryAllocator &allocator) const
     { return new (allocator) this_type (val); }
@@ -665,9 +793,9 @@ namespace expr
     bool operator== (const Operator& rhs) const
     {
       if (&rhs == this) return true;
+      if (rhs.code () != this->m_code) return false;
 
-      const this_type *prhs = dynamic_cast<const this_type*> (&rhs);
-      if (prhs == NULL) return false;
+      const this_type *prhs = static_cast<const this_type*> (&rhs);
       return terminal_type::equal_to (val, prhs->val);
     }
 
@@ -676,11 +804,11 @@ namespace expr
       // x < x is false
       if (&rhs == this) return false;
 
-      const this_type *prhs = dynamic_cast<const this_type*> (&rhs);
-    
-      return (prhs == NULL) ? 
-	typeid(this_type).before (typeid (rhs)) :
-	terminal_type::less (val, prhs->val);
+      if (rhs.code () != this->m_code)
+	return typeid(this_type).before (typeid (rhs));
+
+      const this_type *prhs = static_cast<const this_type*> (&rhs);
+      return terminal_type::less (val, prhs->val);
     }
 
     size_t hash () const { return terminal_type::hash (val); }
@@ -777,9 +905,16 @@ namespace expr
     
     static inline size_t hash (const mpz_class &v)
     {
-      std::string str = boost::lexical_cast<std::string> (v);
-      std::hash<std::string> hasher;
-      return hasher (str);
+      // -- small values are hashed directly, large ones limb by limb
+      if (v.fits_slong_p ())
+      {
+        std::hash<long> hasher;
+        return hasher (v.get_si ());
+      }
+      size_t res = mpz_sgn (v.get_mpz_t ());
+      for (size_t i = 0; i < mpz_size (v.get_mpz_t ()); i++)
+        boost::hash_combine (res, mpz_getlimbn (v.get_mpz_t (), i));
+      return res;
     }
     
     
@@ -803,9 +938,11 @@ namespace expr
     
     static inline size_t hash (const mpq_class &v)
     {
-      std::string str = boost::lexical_cast<std::string> (v);
-      std::hash<std::string> hasher;
-      return hasher (str);
+      // -- integral values hash like the corresponding mpz_class
+      size_t res = TerminalTrait<mpz_class>::hash (v.get_num ());
+      if (v.get_den () != 1)
+        boost::hash_combine (res, TerminalTrait<mpz_class>::hash (v.get_den ()));
+      return res;
     }    
   };
 
@@ -986,6 +1123,12 @@ namespace expr
     typedef B base_type;
     typedef T op_type;
     typedef P ps_type;
+
+    DefOp ()
+    {
+      this->m_code = opCode<this_type> ();
+      this->m_cats = opCategories<B> (IsOpCategory<B> ());
+    }
     
     void Print (std::ostream &OS, 
 		const std::vector<ENode*> &args,
@@ -994,7 +1137,7 @@ namespace expr
     { ps_type::print (OS, depth, brkt, op_type::name (), args);  }
 
     bool operator== (const Operator& rhs) const
-    { return typeid (*this) == typeid (rhs); }
+    { return rhs.code () == this->m_code; }
 
 
     bool operator< (const Operator& rhs) const
@@ -1009,6 +1152,7 @@ namespace expr
 
   inline ENode::~ENode () 
   {
+    delete meta;
     for (args_iterator b = args.begin (), e = args.end ();
 	 b != e; ++b)
       efac().Deref (*b);
@@ -1021,6 +1165,9 @@ namespace expr
   {
     std::vector<ENode*> old = args;
     args = std::vector<ENode*> ();
+    // -- the facts of a mutable node change with its arguments
+    delete meta;
+    meta = NULL;
     
     // -- increment reference count of all new arguments
     for (; b != e; ++b)
@@ -1134,6 +1281,122 @@ namespace expr
   };
 
 
+  /**
+   * Set of expressions for large, lookup-heavy uses: an open-addressing
+   * table of node pointers (linear probing, hashed by id).
+   * Iterates in insertion order
+   */
+  class ExprHashSet
+  {
+    /** NULL marks an empty slot; the size is a power of 2 */
+    std::vector<ENode*> table;
+    /** keeps the elements alive */
+    ExprVector elems;
+
+    static size_t hash (const ENode *n) { return n->getId () * 2654435761u; }
+
+    size_t slot (const ENode *n) const
+    {
+      size_t mask = table.size () - 1;
+      size_t i = hash (n) & mask;
+      while (table [i] != NULL && table [i] != n) i = (i + 1) & mask;
+      return i;
+    }
+
+    void grow ()
+    {
+      std::vector<ENode*> old (2 * table.size (), NULL);
+      old.swap (table);
+      for (ENode *n : old) if (n != NULL) table [slot (n)] = n;
+    }
+
+  public:
+    typedef ExprVector::const_iterator const_iterator;
+
+    ExprHashSet () : table (16, NULL) {}
+
+    /** returns false if e is already there */
+    bool insert (Expr e)
+    {
+      if (2 * (elems.size () + 1) > table.size ()) grow ();
+      size_t i = slot (&*e);
+      if (table [i] != NULL) return false;
+      table [i] = &*e;
+      elems.push_back (e);
+      return true;
+    }
+
+    size_t count (Expr e) const { return table [slot (&*e)] != NULL ? 1 : 0; }
+
+    void clear ()
+    {
+      std::fill (table.begin (), table.end (), (ENode*) NULL);
+      elems.clear ();
+    }
+
+    size_t size () const { return elems.size (); }
+    bool empty () const { return elems.empty (); }
+    const_iterator begin () const { return elems.begin (); }
+    const_iterator end () const { return elems.end (); }
+  };
+
+  /**
+   * Set of expressions for small uses: a vector sorted by id
+   * (i.e., in the same order as ExprSet). Works with std::inserter
+   */
+  class ExprFlatSet
+  {
+    ExprVector elems;
+
+    static bool lessId (const Expr &a, const Expr &b) { return a->getId () < b->getId (); }
+
+  public:
+    typedef Expr value_type;
+    typedef ExprVector::const_iterator const_iterator;
+    typedef const_iterator iterator;
+
+    ExprFlatSet () {}
+    template <typename Range>
+    ExprFlatSet (const Range &r) { insert (r.begin (), r.end ()); }
+
+    std::pair<iterator,bool> insert (Expr e)
+    {
+      ExprVector::iterator it = std::lower_bound (elems.begin (), elems.end (), e, lessId);
+      if (it != elems.end () && *it == e) return std::make_pair (iterator (it), false);
+      return std::make_pair (iterator (elems.insert (it, e)), true);
+    }
+
+    /** hinted insertion, as needed by std::inserter */
+    iterator insert (iterator hint, Expr e) { return insert (e).first; }
+
+    template <typename iter>
+    void insert (iter b, iter e)
+    {
+      elems.insert (elems.end (), b, e);
+      std::sort (elems.begin (), elems.end (), lessId);
+      elems.erase (std::unique (elems.begin (), elems.end ()), elems.end ());
+    }
+
+    size_t count (Expr e) const
+    {
+      return std::binary_search (elems.begin (), elems.end (), e, lessId) ? 1 : 0;
+    }
+
+    size_t erase (Expr e)
+    {
+      ExprVector::iterator it = std::lower_bound (elems.begin (), elems.end (), e, lessId);
+      if (it == elems.end () || *it != e) return 0;
+      elems.erase (it);
+      return 1;
+    }
+
+    void clear () { elems.clear (); }
+    size_t size () const { return elems.size (); }
+    bool empty () const { return elems.empty (); }
+    const_iterator begin () const { return elems.begin (); }
+    const_iterator end () const { return elems.end (); }
+  };
+
   typedef std::unordered_map<ENode*,Expr> DagVisitCache;
 
   template <typename ExprVisitor> 
@@ -1194,6 +1457,144 @@ namespace expr
     return res;
   }  
 
+  /**
+   * A visit cache that persists across calls.
+   * Keys are not referenced: the cache is registered with the factory and
+   * an entry is dropped as soon as its key is freed
+   */
+  class PersistentVisitCache : boost::noncopyable
+  {
+    typedef std::unordered_map<ENode*,Expr> cache_type;
+
+    /** NULL once the factory is gone */
+    ExprFactory *efac;
+    /** NULL value means the key is mapped to itself */
+    cache_type cache;
+
+  public:
+    PersistentVisitCache (ExprFactory &f) : efac (&f) { efac->registerCache (*this); }
+    ~PersistentVisitCache () { if (efac) efac->unregisterCache (*this); }
+
+    bool detached () const { return efac == NULL; }
+
+    /** returns the memoized image of e, or NULL */
+    Expr find (Expr e) const
+    {
+      cache_type::const_iterator it = cache.find (&*e);
+      if (it == cache.end ()) return Expr ();
+      return it->second ? it->second : e;
+    }
+
+    void insert (Expr e, Expr res) { cache [&*e] = (res == e) ? Expr () : res; }
+
+    void erase (ENode *val)
+    {
+      cache_type::iterator it = cache.find (val);
+      if (it == cache.end ()) return;
+      // -- release the value only after the map is consistent again
+      Expr res = it->second;
+      cache.erase (it);
+    }
+
+    void clear ()
+    {
+      cache_type tmp;
+      tmp.swap (cache);
+    }
+
+    void detach ()
+    {
+      efac = NULL;
+      clear ();
+    }
+
+    size_t size () const { return cache.size (); }
+  };
+
+  /**
+   * A per-factory instance of T, constructed from the factory on demand
+   * and destroyed together with it. Tag tells apart instances of the same T
+   */
+  template <typename T, typename Tag = T>
+  class FactoryLocal : boost::noncopyable
+  {
+    ExprFactory *efac;
+    std::unique_ptr<T> obj;
+
+    FactoryLocal (ExprFactory &f) : efac (&f), obj (new T (f)) { efac->registerCache (*this); }
+
+  public:
+    ~FactoryLocal () { if (efac) efac->unregisterCache (*this); }
+
+    void erase (ENode *val) { }
+    void detach ()
+    {
+      efac = NULL;
+      obj.reset ();
+    }
+
+    static T &get (ExprFactory &efac)
+    {
+      static std::map<ExprFactory*, std::unique_ptr<FactoryLocal>> locals;
+      std::unique_ptr<FactoryLocal> &l = locals [&efac];
+      // -- a detached instance belonged to a factory that is gone
+      if (!l || !l->obj) l.reset (new FactoryLocal (efac));
+      return *l->obj;
+    }
+  };
+
+  /**
+   * Same as above, but every node is memoized in a cache that outlives the call.
+   * Only sound if the visitor is pure, i.e., the result depends on the node alone
+   */
+  template <typename ExprVisitor>
+  Expr visit (ExprVisitor &v, Expr expr, PersistentVisitCache &cache)
+  {
+    Expr res = cache.find (expr);
+    if (res) return res;
+
+    VisitAction va = v(expr);
+
+    if (va.isSkipKids ())
+      res = expr;
+    else if (va.isChangeTo ())
+      res = va.getExpr ();
+    else
+      {
+	res = va.isChangeDoKidsRewrite () ? va.getExpr () : expr;
+	if (res->arity () > 0)
+	  {
+	    bool changed = false;
+            std::vector<Expr> kids;
+
+	    for (ENode::args_iterator b = res->args_begin (),
+		   e = res->args_end ();
+		 b != e; ++b)
+	      {
+		Expr k = visit (v, *b, cache);
+		kids.push_back (k);
+		changed  = (changed || k.get () != *b);
+	      }
+
+	    if (changed)
+	      {
+		if (!res->isMutable ())
+		  res = res->getFactory ().mkNary (res->op (),
+						   kids.begin (),
+						   kids.end ());
+		else
+		  res->renew_args (kids.begin (), kids.end ());
+	      }
+	  }
+
+	res = va.rewrite (res);
+      }
+
+    // -- mutable nodes can change under the cache
+    if (!expr->isMutable ()) cache.insert (expr, res);
+    return res;
+  }
+
   inline void clearDagVisitCache (DagVisitCache &cache)
   {
     for (DagVisitCache::value_type &kv : cache) 
@@ -1280,19 +1681,54 @@ namespace expr
   /* Inspection */
   /**********************************************************************/
   
+  namespace details
+  {
+    template <typename O>
+    struct IsDefOp : std::false_type {};
+    template <typename T, typename B, typename P>
+    struct IsDefOp<DefOp<T,B,P> > : std::true_type {};
+
+    /** kind of the test of isOp: 0 -- RTTI, 1 -- category, 2 -- final type */
+    template <typename O, int kind = IsOpCategory<O>::value ? 1 :
+                                     IsDefOp<O>::value ? 2 : 0>
+    struct IsOpTest
+    {
+      static bool test (const Operator &op)
+      { return dynamic_cast<const O*> (&op) != NULL; }
+    };
+
+    template <typename O> struct IsOpTest<O,1>
+    {
+      static bool test (const Operator &op)
+      {
+        if (op.code () == 0) return IsOpTest<O,0>::test (op);
+        return (op.categories () & opCategory<O> ()) != 0;
+      }
+    };
+
+    template <typename O> struct IsOpTest<O,2>
+    {
+      static bool test (const Operator &op)
+      {
+        if (op.code () == 0) return IsOpTest<O,0>::test (op);
+        return op.code () == opCode<O> ();
+      }
+    };
+  }
+
   // -- usage isOp<TYPE>(EXPR) . Returns true if top operator of
   // -- expression is a subclass of TYPE.
   template <typename O, typename T> bool isOp (T e)
-  {
-    const Operator *op = & (eptr(e)->op ());
-    const O *top = dynamic_cast<const O*>(op);
-    return top != NULL;
-  }
+  { return details::IsOpTest<O>::test (eptr (e)->op ()); }
   
   // -- usage isOpX<TYPE>(EXPR) . Returns true if top operator of
   // -- expression is of type TYPE.    
   template <typename O, typename T> bool isOpX (T e)
-  { return typeid (eptr (e)->op ()) == typeid (O); }
+  {
+    const Operator &op = eptr (e)->op ();
+    if (op.code () == 0) return typeid (op) == typeid (O);
+    return op.code () == opCode<O> ();
+  }
 
   /**********************************************************************/
   /* Creation */
@@ -1317,7 +1753,54 @@ namespace expr
   template <typename T> T getTerm (Expr e)
   {
     typedef Terminal<T> term_type;
-    return dynamic_cast<const term_type&>(e->op ()).get ();
+    assert (isOpX<term_type> (e));
+    return static_cast<const term_type&>(e->op ()).get ();
+  }
+
+  /* Copy-free access to the value of a terminal */
+  template <typename T> const T &getTermRef (Expr e)
+  {
+    typedef Terminal<T> term_type;
+    assert (isOpX<term_type> (e));
+    return static_cast<const term_type&>(e->op ()).ref ();
+  }
+
+  /* Numerals (MPZ and MPQ terminals) without a round trip through strings.
+   * Values that fit into a long are read on a fast path, with no allocation.
+   */
+  inline bool isNum (Expr e)
+  { return isOpX<op::MPZ> (e) || isOpX<op::MPQ> (e); }
+
+  inline mpq_class getNum (Expr e)
+  {
+    if (isOpX<op::MPZ> (e)) return mpq_class (getTermRef<mpz_class> (e));
+    return getTermRef<mpq_class> (e);
+  }
+
+  /* true iff e is an integral numeral that fits into a long */
+  inline bool getSmallNum (Expr e, long &v)
+  {
+    if (isOpX<op::MPZ> (e))
+    {
+      const mpz_class &z = getTermRef<mpz_class> (e);
+      if (!z.fits_slong_p ()) return false;
+      v = z.get_si ();
+      return true;
+    }
+    if (isOpX<op::MPQ> (e))
+    {
+      const mpq_class &q = getTermRef<mpq_class> (e);
+      if (q.get_den () != 1 || !q.get_num ().fits_slong_p ()) return false;
+      v = q.get_num ().get_si ();
+      return true;
+    }
+    return false;
+  }
+
+  inline bool isNumEq (Expr e, long v)
+  {
+    long w;
+    return getSmallNum (e, w) && w == v;
   }
   
 
@@ -1411,6 +1894,44 @@ namespace expr
     NOP(IMPL,"->",INFIX,BoolOp)
     NOP(ITE,"ite",FUNCTIONAL,BoolOp)
     NOP(IFF,"<->",INFIX,BoolOp)
+  }
+
+  inline Expr ExprFactory::mkTrue ()
+  {
+    if (!trueE) trueE = mkTerm (op::TRUE ());
+    return trueE;
+  }
+
+  inline Expr ExprFactory::mkFalse ()
+  {
+    if (!falseE) falseE = mkTerm (op::FALSE ());
+    return falseE;
+  }
+
+  inline Expr ExprFactory::mkZero ()
+  {
+    if (!zeroE) zeroE = mkTerm (op::MPZ (mpz_class (0)));
+    return zeroE;
+  }
+
+  inline Expr ExprFactory::mkOne ()
+  {
+    if (!oneE) oneE = mkTerm (op::MPZ (mpz_class (1)));
+    return oneE;
+  }
+
+  inline Expr ExprFactory::mkMinusOne ()
+  {
+    if (!minusOneE) minusOneE = mkTerm (op::MPZ (mpz_class (-1)));
+    return minusOneE;
+  }
+
+  /* mk<TRUE> and mk<FALSE> skip the unique table */
+  template <> inline Expr mk<op::TRUE> (ExprFactory &f) { return f.mkTrue (); }
+  template <> inline Expr mk<op::FALSE> (ExprFactory &f) { return f.mkFalse (); }
+
+  namespace op
+  {
 
     namespace boolop 
     {
@@ -2711,23 +3232,6 @@ namespace expr
       { return exp == s ? VisitAction::changeTo (t) : VisitAction::doKids (); }
     };
 
-    struct RAVALL: public std::unary_function<Expr,VisitAction>
-    {
-      ExprVector* s;
-      ExprVector* t;
-      unsigned int sz;
-
-      RAVALL (ExprVector* _s, ExprVector* _t) : s(_s), t(_t), sz(_s->size()) { }
-      VisitAction operator() (Expr exp) const
-      {
-        // TODO: could be optimized further,
-        // e.g., when all elements of s and t have the same type...
-        for (unsigned int i = 0; i < sz; i++ )
-          if (exp == s->at(i)) return VisitAction::changeTo (t->at(i));
-        return VisitAction::doKids ();
-      }
-    };
-
     struct RAVALLM: public std::unary_function<Expr,VisitAction>
     {
       ExprMap& m;
@@ -2735,7 +3239,9 @@ namespace expr
       RAVALLM (ExprMap& _m) : m(_m) { }
       VisitAction operator() (Expr exp) const
       {
-        if (m[exp] != NULL) return VisitAction::changeTo (m[exp]);
+        ExprMap::const_iterator it = m.find (exp);
+        if (it != m.end () && it->second != NULL)
+          return VisitAction::changeTo (it->second);
         return VisitAction::doKids ();
       }
     };
@@ -2765,7 +3271,7 @@ namespace expr
       F filter;
       
       OutputIterator out;
-      ExprSet seen;
+      ExprHashSet seen;
       
       typedef FV<F,OutputIterator> this_type;
       FV (const this_type &o) : filter (o.filter), out(o.out), seen (o.seen) 
@@ -2774,8 +3280,7 @@ namespace expr
       FV (F f, OutputIterator o) : filter (f), out (o) {}
       VisitAction operator() (Expr exp) 
       { 
-	if (seen.count (exp) > 0) return VisitAction::skipKids ();
-	seen.insert (exp);
+	if (!seen.insert (exp)) return VisitAction::skipKids ();
 
 	if (filter (exp))
 	  { 
@@ -2920,6 +3425,26 @@ namespace expr
     return dagVisit (rw, e);
   }
   
+  /**
+   * Persistent memo of the pure rewriter T over efac (see PersistentVisitCache)
+   */
+  template <typename T>
+  PersistentVisitCache &getPureRewriteCache (ExprFactory &efac)
+  {
+    return FactoryLocal<PersistentVisitCache, T>::get (efac);
+  }
+
+  /**
+   * Applies a pure rewriter, reusing the results of previous applications
+   * of any rewriter of the same type (so they all must behave the same)
+   */
+  template <typename T>
+  Expr rewritePure (std::shared_ptr<T> r, Expr e)
+  {
+    RW<T> rw(r);
+    return visit (rw, e, getPureRewriteCache<T> (e->getFactory ()));
+  }
+
   /** Size of an expression as a DAG */
   inline size_t dagSize (Expr e)
   {
@@ -2928,12 +3453,93 @@ namespace expr
     return sz.count;
   }
 
+  const ENodeMeta &nodeMeta (ENode *e);
+
+  namespace details
+  {
+    inline bool isSizeNode (Expr e)
+    {
+      return (isOp<ComparissonOp> (e) || isOp<BoolOp> (e)) &&
+        !isOpX<TRUE> (e) && !isOpX<FALSE> (e);
+    }
+
+    inline const std::shared_ptr<const ENodeMeta::consts_type> &noConsts ()
+    {
+      static const std::shared_ptr<const ENodeMeta::consts_type>
+        empty (new ENodeMeta::consts_type ());
+      return empty;
+    }
+  }
+
+  /**
+   * Structural facts about e, computed bottom-up over the DAG once per node
+   */
+  inline const ENodeMeta &nodeMeta (ENode *e)
+  {
+    if (e->meta != NULL) return *e->meta;
+
+    typedef ENodeMeta::consts_type consts_type;
+    std::unique_ptr<ENodeMeta> m (new ENodeMeta ());
+    Expr exp (e);
+    bool isConst = bind::IsConst () (exp);
+
+    m->treeSize = details::isSizeNode (exp) ? 1 : 0;
+    m->depth = 0;
+    std::shared_ptr<const consts_type> cs;
+    if (isConst) cs = std::make_shared<const consts_type> (1, e);
+
+    for (ENode *kid : e->args)
+    {
+      const ENodeMeta &k = nodeMeta (kid);
+      m->treeSize = (m->treeSize + k.treeSize < m->treeSize) ?
+        SIZE_MAX : m->treeSize + k.treeSize;
+      m->depth = std::max (m->depth, k.depth);
+      if (isConst || k.consts->empty () || k.consts == cs) continue;
+      if (!cs || cs->empty ())
+      {
+        cs = k.consts;
+        continue;
+      }
+
+      std::shared_ptr<consts_type> u (new consts_type ());
+      u->reserve (cs->size () + k.consts->size ());
+      std::set_union (cs->begin (), cs->end (), k.consts->begin (), k.consts->end (),
+                      std::back_inserter (*u), std::less<ENode*> ());
+      if (u->size () == k.consts->size ()) cs = k.consts;
+      else if (u->size () != cs->size ()) cs = u;
+    }
+    m->depth++;
+    m->consts = cs ? cs : details::noConsts ();
+
+    e->meta = m.release ();
+    return *e->meta;
+  }
+
   /** Size of an expression as a tree */
-  inline size_t treeSize (Expr e)
+  inline size_t treeSize (Expr e) { return nodeMeta (&*e).treeSize; }
+
+  /** Number of nodes on the longest path from the root to a leaf */
+  inline unsigned exprDepth (Expr e) { return nodeMeta (&*e).depth; }
+
+  /**
+   * Constants of e, i.e., the result of filter with bind::IsConst, but
+   * ordered by id (as in ExprSet) and cached in the nodes
+   */
+  inline const ENodeMeta::consts_type &constsOf (Expr e)
+  { return *nodeMeta (&*e).consts; }
+
+  /** Inserts the constants of e into a set ordered by id */
+  template <typename Set> void getConsts (Expr e, Set &out)
   {
-    SIZE sz;
-    visit (sz, e);
-    return sz.count;
+    const ENodeMeta::consts_type &cs = constsOf (e);
+    out.insert (cs.begin (), cs.end ());
+  }
+
+  /** Whether the constant c occurs in e */
+  inline bool hasConst (Expr e, Expr c)
+  {
+    const ENodeMeta::consts_type &cs = constsOf (e);
+    return std::binary_search (cs.begin (), cs.end (), &*c, std::less<ENode*> ());
   }
   
 
@@ -2944,12 +3550,109 @@ namespace expr
     return dagVisit (rav, exp);
   }
 
+  /**
+   * Pairwise replacements from[i] -> to[i], applied simultaneously.
+   * Lookups go through an open-addressing table of node pointers
+   * (linear probing) and never insert
+   */
+  class Substitution
+  {
+    typedef std::pair<ENode*,unsigned> slot_type;
+
+    /** NULL key marks an empty slot; the size is a power of 2 */
+    std::vector<slot_type> table;
+    /** keeps the keys alive, in insertion order */
+    ExprVector from;
+    ExprVector to;
+
+    static size_t hash (const ENode *n) { return n->getId () * 2654435761u; }
+
+    size_t slot (const ENode *n) const
+    {
+      size_t mask = table.size () - 1;
+      size_t i = hash (n) & mask;
+      while (table [i].first != NULL && table [i].first != n) i = (i + 1) & mask;
+      return i;
+    }
+
+    void grow ()
+    {
+      std::vector<slot_type> old (2 * table.size (), slot_type (NULL, 0));
+      old.swap (table);
+      for (const slot_type &s : old)
+	if (s.first != NULL) table [slot (s.first)] = s;
+    }
+
+    struct Visitor : public std::unary_function<Expr,VisitAction>
+    {
+      const Substitution &subst;
+
+      Visitor (const Substitution &s) : subst(s) {}
+      VisitAction operator() (Expr exp) const
+      {
+	Expr t = subst.find (exp);
+	return t != NULL ? VisitAction::changeTo (t) : VisitAction::doKids ();
+      }
+    };
+
+  public:
+    Substitution () : table (16, slot_type (NULL, 0)) {}
+
+    /** as in replaceAll, the first occurrence of a key wins */
+    Substitution (const ExprVector &s, const ExprVector &t) :
+      table (16, slot_type (NULL, 0))
+    {
+      assert (s.size () == t.size ());
+      for (unsigned i = 0; i < s.size (); i++) add (s [i], t [i]);
+    }
+
+    /** maps s to t; returns false (and keeps the old image) if s is mapped */
+    bool add (Expr s, Expr t)
+    {
+      if (2 * (from.size () + 1) > table.size ()) grow ();
+      size_t i = slot (&*s);
+      if (table [i].first != NULL) return false;
+      table [i] = slot_type (&*s, from.size ());
+      from.push_back (s);
+      to.push_back (t);
+      return true;
+    }
+
+    /** returns the image of e, or NULL */
+    Expr find (Expr e) const
+    {
+      const slot_type &s = table [slot (&*e)];
+      return s.first != NULL ? to [s.second] : Expr ();
+    }
+
+    /**
+     * this := [s := t] after this, by updating the images in place.
+     * Exact (i.e., same as applying both in sequence) if s is a constant
+     */
+    bool compose (Expr s, Expr t)
+    {
+      if (find (s) != NULL) return false;
+      for (Expr &e : to) e = replaceAll (e, s, t);
+      return add (s, t);
+    }
+
+    Expr operator() (Expr exp) const
+    {
+      if (from.empty ()) return exp;
+      Visitor v (*this);
+      return dagVisit (v, exp);
+    }
+
+    const ExprVector &keys () const { return from; }
+    const ExprVector &images () const { return to; }
+    size_t size () const { return from.size (); }
+    bool empty () const { return from.empty (); }
+  };
+
   // pairwise replacing
   inline Expr replaceAll (Expr exp, ExprVector& s, ExprVector& t)
   {
-    assert(s.size() == t.size());
-    RAVALL rav(&s, &t);
-    return dagVisit (rav, exp);
+    return Substitution (s, t) (exp);
   }
 
   // pairwise replacing
@@ -3132,18 +3835,14 @@ namespace expr
 
 namespace std
 {
-  /** standard order of expressions by their id */
-  template <> struct less<expr::ENode*>
+  inline bool less<expr::ENode*>::operator() (const expr::ENode *x,
+                                              const expr::ENode *y) const
   {
-    bool operator() (const expr::ENode *x, const expr::ENode *y) const
-    {
-      if (x == NULL) return y != NULL;
-      if (y == NULL) return false;
-      
-      return x->getId () < y->getId ();
-    }
-    
-  };
+    if (x == NULL) return y != NULL;
+    if (y == NULL) return false;
+
+    return x->getId () < y->getId ();
+  }
 
 }
 
@@ -3188,6 +3887,8 @@ namespace expr
 	}
       cache.clear ();
     }
+
+    void detach () { clear (); }
     
     const_iterator find (Expr e) 
     {
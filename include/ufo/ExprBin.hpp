@@ -0,0 +1,336 @@
+#ifndef __EXPR_BIN__HPP_
+#define __EXPR_BIN__HPP_
+
+/** Binary format of expression DAGs
+ *
+ * A file is a header, a pool of terminal values, a table of nodes in
+ * topological order (children first) and the indices of the roots.
+ * Everything is a sequence of 32-bit words in host byte order, so a
+ * mapped file is read in place. A node is a tag followed by either the
+ * pool offset of its value (terminals) or its arity and child indices.
+ *
+ * Tags are fixed by the order of registration in OpTable: append only.
+ */
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <stdexcept>
+#include <fstream>
+#include <unordered_map>
+
+#include "ufo/Expr.hpp"
+
+namespace expr
+{
+  namespace bin
+  {
+    const uint32_t MAGIC = 0x42584541; // "AEXB"
+    const uint32_t VERSION = 1;
+
+    struct Header
+    {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t poolWords;
+      uint32_t nodeWords;
+      uint32_t nodes;
+      uint32_t roots;
+    };
+
+    /** terminal tags; operator tags follow */
+    enum { T_STRING, T_INT, T_UINT, T_ULONG, T_MPZ, T_MPQ, T_BVAR, T_FIRST_OP };
+
+    /** no upper bound on the arity */
+    const uint32_t NARY = ~0u;
+
+    typedef Expr (*maker_type) (ExprFactory &, const ExprVector &);
+
+    template <typename T>
+    Expr mkOp (ExprFactory &efac, const ExprVector &kids)
+    { return efac.mkNary (T (), kids.begin (), kids.end ()); }
+
+    struct OpTable
+    {
+      /** tag + 1 by opcode, 0 if the operator has no tag */
+      std::vector<uint32_t> tags;
+      std::vector<maker_type> makers;
+      /** the least and the greatest arity, by operator tag - T_FIRST_OP */
+      std::vector<std::pair<uint32_t,uint32_t> > arities;
+
+      void setTag (unsigned code, uint32_t tag)
+      {
+	if (tags.size () <= code) tags.resize (code + 1, 0);
+	tags [code] = tag + 1;
+      }
+
+      template <typename T> void term (uint32_t tag)
+      { setTag (opCode<T> (), tag); }
+
+      template <typename T> void op (uint32_t lo, uint32_t hi)
+      {
+	setTag (opCode<T> (), T_FIRST_OP + makers.size ());
+	makers.push_back (&mkOp<T>);
+	arities.push_back (std::make_pair (lo, hi));
+      }
+
+      template <typename T> void op (uint32_t n) { op<T> (n, n); }
+
+      OpTable ()
+      {
+	using namespace op;
+	term<STRING> (T_STRING);
+	term<INT> (T_INT);
+	term<UINT> (T_UINT);
+	term<ULONG> (T_ULONG);
+	term<MPZ> (T_MPZ);
+	term<MPQ> (T_MPQ);
+	term<BVAR> (T_BVAR);
+
+	op<TRUE> (0); op<FALSE> (0); op<AND> (1, NARY); op<OR> (1, NARY); op<XOR> (2);
+	op<NEG> (1); op<IMPL> (2); op<ITE> (3); op<IFF> (2);
+	op<PLUS> (1, NARY); op<MINUS> (2, NARY); op<MULT> (1, NARY); op<DIV> (2); op<IDIV> (2);
+	op<MOD> (2); op<REM> (2); op<UN_MINUS> (1); op<ABS> (1);
+	op<EQ> (2); op<NEQ> (2); op<LEQ> (2); op<GEQ> (2); op<LT> (2); op<GT> (2);
+	op<INT_TY> (0); op<REAL_TY> (0); op<BOOL_TY> (0); op<UNINT_TY> (0); op<ARRAY_TY> (2);
+	op<SELECT> (2); op<STORE> (3); op<CONST_ARRAY> (2);
+	op<BIND> (2); op<FDECL> (2, NARY); op<FAPP> (1, NARY);
+	op<FORALL> (1, NARY); op<EXISTS> (1, NARY); op<LAMBDA> (1, NARY);
+      }
+
+      /** returns false if the operator has no tag */
+      bool tag (const Operator &o, uint32_t &t) const
+      {
+	if (o.code () >= tags.size () || tags [o.code ()] == 0) return false;
+	t = tags [o.code ()] - 1;
+	return true;
+      }
+    };
+
+    inline const OpTable &opTable ()
+    {
+      static OpTable table;
+      return table;
+    }
+
+    namespace details
+    {
+      inline void pushStr (std::vector<uint32_t> &pool, const std::string &s)
+      {
+	pool.push_back (s.size ());
+	size_t at = pool.size ();
+	pool.resize (at + (s.size () + 3) / 4, 0);
+	if (!s.empty ()) memcpy (&pool [at], s.data (), s.size ());
+      }
+
+      inline std::string termStr (Expr e, uint32_t tag)
+      {
+	using namespace op;
+	switch (tag)
+	  {
+	  case T_STRING: return getTermRef<std::string> (e);
+	  case T_INT: return boost::lexical_cast<std::string> (getTerm<int> (e));
+	  case T_UINT: return boost::lexical_cast<std::string> (getTerm<unsigned int> (e));
+	  case T_ULONG: return boost::lexical_cast<std::string> (getTerm<unsigned long> (e));
+	  case T_MPZ: return getTermRef<mpz_class> (e).get_str (16);
+	  case T_MPQ: return getTermRef<mpq_class> (e).get_str (16);
+	  default: return boost::lexical_cast<std::string> (bind::bvarId (e));
+	  }
+      }
+
+      /** returns NULL if s is not a value of the tag */
+      inline Expr mkTermStr (uint32_t tag, const std::string &s, ExprFactory &efac)
+      {
+	using namespace op;
+	try
+	  {
+	    switch (tag)
+	      {
+	      case T_STRING: return mkTerm<std::string> (s, efac);
+	      case T_INT: return mkTerm<int> (boost::lexical_cast<int> (s), efac);
+	      case T_UINT: return mkTerm<unsigned int> (boost::lexical_cast<unsigned int> (s), efac);
+	      case T_ULONG: return mkTerm<unsigned long> (boost::lexical_cast<unsigned long> (s), efac);
+	      case T_MPZ: return mkTerm (mpz_class (s, 16), efac);
+	      case T_MPQ:
+		{
+		  mpq_class q (s, 16);
+		  if (q.get_den () == 0) return NULL;
+		  q.canonicalize ();
+		  return mkTerm (q, efac);
+		}
+	      default: return mkTerm (bind::BoundVar (boost::lexical_cast<unsigned> (s)), efac);
+	      }
+	  }
+	catch (boost::bad_lexical_cast &) { return NULL; }
+	catch (std::invalid_argument &) { return NULL; }
+      }
+    }
+
+    /**
+     * Serialize the DAG of roots; returns false if some operator has no tag
+     */
+    inline bool write (const ExprVector &roots, std::string &out)
+    {
+      const OpTable &table = opTable ();
+      std::unordered_map<ENode*,uint32_t> index;
+      std::vector<uint32_t> pool;
+      std::vector<uint32_t> nodes;
+
+      // -- iterative post-order
+      std::vector<std::pair<ENode*,bool> > stack;
+      for (auto it = roots.rbegin (); it != roots.rend (); ++it)
+	stack.push_back (std::make_pair (&**it, false));
+      while (!stack.empty ())
+	{
+	  ENode *n = stack.back ().first;
+	  bool kidsDone = stack.back ().second;
+	  stack.pop_back ();
+	  if (index.count (n) > 0) continue;
+
+	  if (!kidsDone)
+	    {
+	      stack.push_back (std::make_pair (n, true));
+	      for (size_t i = n->arity (); i > 0; i--)
+		if (index.count (n->arg (i - 1)) == 0)
+		  stack.push_back (std::make_pair (n->arg (i - 1), false));
+	      continue;
+	    }
+
+	  uint32_t tag;
+	  if (!table.tag (n->op (), tag)) return false;
+	  nodes.push_back (tag);
+	  if (tag < T_FIRST_OP)
+	    {
+	      nodes.push_back (pool.size ());
+	      details::pushStr (pool, details::termStr (n, tag));
+	    }
+	  else
+	    {
+	      nodes.push_back (n->arity ());
+	      for (auto it = n->args_begin (), end = n->args_end (); it != end; ++it)
+		nodes.push_back (index [*it]);
+	    }
+	  uint32_t idx = index.size ();
+	  index [n] = idx;
+	}
+
+      Header h;
+      h.magic = MAGIC;
+      h.version = VERSION;
+      h.poolWords = pool.size ();
+      h.nodeWords = nodes.size ();
+      h.nodes = index.size ();
+      h.roots = roots.size ();
+
+      out.clear ();
+      out.reserve (sizeof (h) + 4 * (pool.size () + nodes.size () + roots.size ()));
+      out.append ((const char*) &h, sizeof (h));
+      out.append ((const char*) pool.data (), 4 * pool.size ());
+      out.append ((const char*) nodes.data (), 4 * nodes.size ());
+      for (auto &r : roots)
+	{
+	  uint32_t idx = index [&*r];
+	  out.append ((const char*) &idx, 4);
+	}
+      return true;
+    }
+
+    /**
+     * Rebuild the roots from a (possibly mapped) buffer; returns false if it is malformed
+     */
+    inline bool read (const char *data, size_t size, ExprFactory &efac, ExprVector &roots)
+    {
+      if ((uintptr_t) data % 4 != 0)
+	{
+	  std::vector<uint32_t> copy ((size + 3) / 4);
+	  memcpy (copy.data (), data, size);
+	  return read ((const char*) copy.data (), size, efac, roots);
+	}
+
+      Header h;
+      if (size < sizeof (h)) return false;
+      memcpy (&h, data, sizeof (h));
+      if (h.magic != MAGIC || h.version != VERSION) return false;
+      if ((size - sizeof (h)) / 4 < (uint64_t) h.poolWords + h.nodeWords + h.roots) return false;
+      // -- every node takes at least two words, so the count can be trusted below
+      if (h.nodes > h.nodeWords / 2) return false;
+
+      const uint32_t *pool = (const uint32_t*) (data + sizeof (h));
+      const uint32_t *w = pool + h.poolWords;
+      const uint32_t *wend = w + h.nodeWords;
+      const uint32_t *rts = wend;
+      const OpTable &table = opTable ();
+
+      ExprVector nodes;
+      nodes.reserve (h.nodes);
+      ExprVector kids;
+      while (w < wend)
+	{
+	  if (wend - w < 2) return false;
+	  uint32_t tag = *w++;
+	  uint32_t n = *w++;
+	  if (tag < T_FIRST_OP)
+	    {
+	      if (n >= h.poolWords || pool [n] > 4 * (h.poolWords - n - 1)) return false;
+	      std::string s ((const char*) (pool + n + 1), pool [n]);
+	      Expr t = details::mkTermStr (tag, s, efac);
+	      if (t == NULL) return false;
+	      nodes.push_back (t);
+	    }
+	  else
+	    {
+	      if (tag - T_FIRST_OP >= table.makers.size () || (uint32_t) (wend - w) < n) return false;
+	      const std::pair<uint32_t,uint32_t> &ar = table.arities [tag - T_FIRST_OP];
+	      if (n < ar.first || n > ar.second) return false;
+	      kids.clear ();
+	      for (uint32_t i = 0; i < n; i++, w++)
+		{
+		  if (*w >= nodes.size ()) return false;
+		  kids.push_back (nodes [*w]);
+		}
+	      nodes.push_back (table.makers [tag - T_FIRST_OP] (efac, kids));
+	    }
+	}
+      if (nodes.size () != h.nodes) return false;
+
+      for (uint32_t i = 0; i < h.roots; i++)
+	{
+	  if (rts [i] >= nodes.size ()) return false;
+	  roots.push_back (nodes [rts [i]]);
+	}
+      return true;
+    }
+
+    inline bool writeFile (const char *fname, const ExprVector &roots)
+    {
+      std::string out;
+      if (!write (roots, out)) return false;
+      std::ofstream f (fname, std::ios::binary);
+      f.write (out.data (), out.size ());
+      return (bool) f;
+    }
+
+    inline bool readFile (const char *fname, ExprFactory &efac, ExprVector &roots)
+    {
+      int fd = open (fname, O_RDONLY);
+      if (fd < 0) return false;
+      struct stat st;
+      if (fstat (fd, &st) != 0 || st.st_size == 0)
+	{
+	  close (fd);
+	  return false;
+	}
+      void *data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close (fd);
+      if (data == MAP_FAILED) return false;
+      bool res = read ((const char*) data, st.st_size, efac, roots);
+      munmap (data, st.st_size);
+      return res;
+    }
+  }
+}
+
+#endif
@@ -315,7 +315,8 @@ namespace ufo
 
     typedef std::unordered_set<Z3_func_decl> Z3_func_decl_set;
 
-    void allDecls (Z3_ast a, Z3_func_decl_set &seen)
+    /** collects the declarations in the order of first occurrence */
+    void allDecls (Z3_ast a, Z3_func_decl_set &seen, std::vector<Z3_func_decl> &decls)
     {
       if (Z3_get_ast_kind (ctx, a) != Z3_APP_AST) return;
 
@@ -324,10 +325,13 @@ namespace ufo
       if (seen.count (fdecl) > 0) return;
 
       if (Z3_get_decl_kind (ctx, fdecl) == Z3_OP_UNINTERPRETED)
-	seen.insert (fdecl);
+	{
+	  seen.insert (fdecl);
+	  decls.push_back (fdecl);
+	}
 
       for (unsigned i = 0; i < Z3_get_app_num_args (ctx, app); i++)
-	allDecls (Z3_get_app_arg (ctx, app, i), seen);
+	allDecls (Z3_get_app_arg (ctx, app, i), seen, decls);
     }
 
 
@@ -348,9 +352,11 @@ namespace ufo
     {
       std::ostringstream out;
       Z3_func_decl_set seen;
+      std::vector<Z3_func_decl> decls;
       z3::ast a (toAst (e));
-      allDecls (static_cast<Z3_ast>(a), seen);
-      for (Z3_func_decl fdecl : seen)
+      allDecls (static_cast<Z3_ast>(a), seen, decls);
+      // -- not in the order of seen: it depends on the addresses
+      for (Z3_func_decl fdecl : decls)
 	out << Z3_func_decl_to_string (ctx, fdecl) << "\n";
       return out.str ();
     }
@@ -628,7 +634,7 @@ namespace ufo
       boost::tribool res =
 	z3l_to_tribool (Z3_solver_check_assumptions (ctx, solver,
 						     raw_av.size (),
-						     &raw_av[0]));
+						     raw_av.data ()));
       ctx.check_error ();
       return res;
     }
@@ -99,7 +99,7 @@ namespace ufo
 
       else if (isOpX<MPQ>(e))
 	{
-	  const MPQ& op = dynamic_cast<const MPQ&>(e->op ());
+	  const MPQ& op = static_cast<const MPQ&>(e->op ());
 
 	  z3::sort sort (ctx, Z3_mk_real_sort (ctx));
 	  std::string sname = boost::lexical_cast<std::string>(op.get());
@@ -107,7 +107,7 @@ namespace ufo
 	}
       else if (isOpX<MPZ>(e))
 	{
-	  const MPZ& op = dynamic_cast<const MPZ&>(e->op ());
+	  const MPZ& op = static_cast<const MPZ&>(e->op ());
 	  z3::sort sort (ctx, Z3_mk_int_sort (ctx));
 	  std::string sname = boost::lexical_cast<std::string>(op.get());
 	  res = Z3_mk_numeral (ctx, sname.c_str (), sort);
@@ -1,5 +1,6 @@
 #include "ae/AeValSolver.hpp"
 #include "ufo/Smt/EZ3.hh"
+#include "ufo/ExprBin.hpp"
 
 using namespace ufo;
 
@@ -10,6 +11,17 @@ using namespace ufo;
  *   <t_part.smt2> = T-part (over x, y)
  *   --skol = to print skolem function
  *   --debug = to print more info and perform sanity checks
+ *   --gen = to generalize each projection before blocking it (fewer iterations)
+ *   --tree = to select the skolem branches by a decision tree over the atoms of projections
+ *   --order = to test the skolem branches that cover most of S (by sampling) and are cheapest first
+ *   --trace <file> = same as --order, but with samples of inputs in <file> (lines of name=value)
+ *   --cubes <K> = to split S into K disjoint cubes solved in parallel processes
+ *   --cache <dir> = to reuse (and store) valid results of equivalent queries in <dir>
+ *                   (results are stored only with --skol: a cached result is verified by its skolem)
+ *   --emit-c <file> = to write the skolem to <file> as C functions, one per existential variable
+ *   --to-aexb = to only convert each smt2-file to an aexb-file next to it
+ *
+ * Each part can also be given as an .aexb-file (a formula in the binary format of ExprBin).
  *
  * Notably, the tool automatically recognizes x and y based on their appearances in S or T.
  *
@@ -30,13 +42,32 @@ bool getBoolValue(const char * opt, bool defValue, int argc, char ** argv)
   return defValue;
 }
 
+int getIntValue(const char * opt, int defValue, int argc, char ** argv)
+{
+  for (int i = 1; i < argc - 1; i++)
+  {
+    if (strcmp(argv[i], opt) == 0) return atoi(argv[i+1]);
+  }
+  return defValue;
+}
+
+char * getStrValue(const char * opt, char * defValue, int argc, char ** argv)
+{
+  for (int i = 1; i < argc - 1; i++)
+  {
+    if (strcmp(argv[i], opt) == 0) return argv[i+1];
+  }
+  return defValue;
+}
+
 char * getSmtFileName(int num, int argc, char ** argv)
 {
   int num1 = 1;
   for (int i = 1; i < argc; i++)
   {
     int len = strlen(argv[i]);
-    if (len >= 5 && strcmp(argv[i] + len - 5, ".smt2") == 0)
+    if (len >= 5 && (strcmp(argv[i] + len - 5, ".smt2") == 0 ||
+                     strcmp(argv[i] + len - 5, ".aexb") == 0))
     {
       if (num1 == num) return argv[i];
       else num1++;
@@ -45,6 +76,33 @@ char * getSmtFileName(int num, int argc, char ** argv)
   return NULL;
 }
 
+Expr readFormula(EZ3 & z3, ExprFactory & efac, char * fname)
+{
+  int len = strlen(fname);
+  if (strcmp(fname + len - 5, ".smt2") == 0) return z3_from_smtlib_file (z3, fname);
+
+  ExprVector roots;
+  if (!expr::bin::readFile(fname, efac, roots) || roots.size() != 1)
+  {
+    outs() << "Unable to read " << fname << "\n";
+    exit(1);
+  }
+  return roots[0];
+}
+
+void writeFormula(Expr e, char * fname)
+{
+  int len = strlen(fname);
+  if (strcmp(fname + len - 5, ".aexb") == 0) return;
+
+  string bname = string(fname, len - 5) + ".aexb";
+  if (!expr::bin::writeFile(bname.c_str(), ExprVector(1, e)))
+  {
+    outs() << "Unable to write " << bname << "\n";
+    exit(1);
+  }
+}
+
 int main (int argc, char ** argv)
 {
 
@@ -56,14 +114,31 @@ int main (int argc, char ** argv)
   bool compact = getBoolValue("--compact", false, argc, argv);
   bool debug = getBoolValue("--debug", false, argc, argv);
   bool split = getBoolValue("--split", false, argc, argv);
+  bool gen = getBoolValue("--gen", false, argc, argv);
+  bool tree = getBoolValue("--tree", false, argc, argv);
+  bool order = getBoolValue("--order", false, argc, argv);
+  char * trace = getStrValue("--trace", NULL, argc, argv);
+  int cubes = getIntValue("--cubes", 1, argc, argv);
+  char * cacheDir = getStrValue("--cache", NULL, argc, argv);
+  char * emitC = getStrValue("--emit-c", NULL, argc, argv);
+  bool toBin = getBoolValue("--to-aexb", false, argc, argv);
+  if (emitC != NULL) skol = true;
 
-  Expr s = z3_from_smtlib_file (z3, getSmtFileName(1, argc, argv));
-  Expr t = z3_from_smtlib_file (z3, getSmtFileName(2, argc, argv));
+  Expr s = readFormula (z3, efac, getSmtFileName(1, argc, argv));
+  Expr t = readFormula (z3, efac, getSmtFileName(2, argc, argv));
+
+  if (toBin)
+  {
+    writeFormula (s, getSmtFileName(1, argc, argv));
+    writeFormula (t, getSmtFileName(2, argc, argv));
+    return 0;
+  }
 
   if (allincl)
     getAllInclusiveSkolem(s, t, debug, compact);
   else
-    aeSolveAndSkolemize(s, t, skol, debug, compact, split);
+    aeSolveAndSkolemize(s, t, skol, debug, compact, split, gen, cubes, cacheDir, emitC, tree,
+                        order, trace);
 
   return 0;
 }